@@ -28,15 +28,138 @@ LICENSE
 
 #define SB_API static
 
+/* C89 has no "long long" so use the compiler specific 64-bit integer types */
+#if defined(_MSC_VER)
+typedef unsigned __int64 sb_u64;
+typedef __int64 sb_i64;
+#elif defined(__GNUC__) || defined(__clang__)
+__extension__ typedef unsigned long long sb_u64;
+__extension__ typedef long long sb_i64;
+#else
+typedef unsigned long sb_u64;
+typedef long sb_i64;
+#endif
+
+/* Build a 64-bit constant from two 32-bit halves (C89 has no ULL suffix) */
+#define SB_U64(hi, lo) ((((sb_u64)(hi)) << 32) | (sb_u64)(lo))
+
+/* SIMD kernels within the compile time baseline (SSE2 on x86-64) are used directly. Kernels that need more
+ * (SSSE3, SSE4.2, ARMv8 CRC32) are built with target attributes and selected at runtime, see sb_cpu_features.
+ * Define SB_NO_SIMD to force the scalar paths.
+ */
+#ifndef SB_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SB_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(SB_SIMD_SSE2) && (defined(__SSSE3__) || defined(__AVX__))
+#define SB_SIMD_SSSE3
+#endif
+#if defined(SB_SIMD_SSE2) && (defined(_MSC_VER) || defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define SB_DISPATCH_X86
+#endif
+#if defined(SB_SIMD_SSSE3) || defined(SB_DISPATCH_X86)
+#define SB_KERNEL_SSSE3
+#include <tmmintrin.h>
+#endif
+#if defined(SB_DISPATCH_X86) || (defined(SB_SIMD_SSSE3) && (defined(__SSE4_2__) || defined(__AVX__)))
+#define SB_KERNEL_SSE42
+#include <nmmintrin.h>
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#define SB_KERNEL_ARM_CRC32
+#include <arm_acle.h>
+#elif defined(__aarch64__) && defined(__linux__) && defined(__GNUC__) && !defined(__clang__)
+#define SB_KERNEL_ARM_CRC32
+#define SB_DISPATCH_ARM
+#endif
+#endif
+
+/* Compiles a kernel for an instruction set above the baseline */
+#if defined(__GNUC__) || defined(__clang__)
+#define SB_TARGET(t) __attribute__((target(t)))
+#else
+#define SB_TARGET(t)
+#endif
+
+/* Hides where a pointer came from. GCC otherwise warns (-Warray-bounds) about
+ * 16 byte SIMD loads in loops that can never run for short string literals.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+#define SB_LAUNDER(p) __asm__("" : "+r"(p))
+#else
+#define SB_LAUNDER(p) (void)(p)
+#endif
+
+/* One time initialisation of tables shared by all threads. state starts at 0. Returns 1 to the single
+ * caller that has to build (and then calls sb_once_done), other callers wait until it is published.
+ */
+SB_API SB_INLINE int sb_once(int *state)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  int expected = 0;
+
+  if (__atomic_load_n(state, __ATOMIC_ACQUIRE) == 2)
+  {
+    return 0;
+  }
+
+  if (__atomic_compare_exchange_n(state, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+  {
+    return 1;
+  }
+
+  while (__atomic_load_n(state, __ATOMIC_ACQUIRE) != 2)
+  {
+    /* The builder only runs for a few microseconds, spin */
+  }
+
+  return 0;
+#else
+  /* volatile accesses are acquire / release with MSVC on x86 and x64 (/volatile:ms) */
+  return *(volatile int *)state != 2;
+#endif
+}
+
+/* Publishes everything built since sb_once returned 1 */
+SB_API SB_INLINE void sb_once_done(int *state)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  __atomic_store_n(state, 2, __ATOMIC_RELEASE);
+#else
+  *(volatile int *)state = 2;
+#endif
+}
+
+/* Length type of the builder. int by default, define SB_WIDE for buffers beyond 2 GB (64-bit lengths). */
+#ifdef SB_WIDE
+typedef sb_i64 sb_size;
+#define SB_SIZE_MAX ((sb_size)SB_U64(0x7ffffffful, 0xfffffffful))
+#else
+typedef int sb_size;
+#define SB_SIZE_MAX 2147483647
+#endif
+
 typedef struct sb
 {
-  char *buf; /* Pointer to string buffer */
-  int cap;   /* Capacity of buffer */
-  int len;   /* Current length of content */
-  int ovr;   /* Overflow flag (1 if exceeded capacity) */
+  char *buf;    /* Pointer to string buffer */
+  sb_size cap;  /* Capacity of buffer */
+  sb_size len;  /* Current length of content */
+  int ovr;      /* Overflow flag (1 if exceeded capacity) */
+  int trunc;    /* Truncation policy applied by sb_term on overflow (SB_TRUNC_* flags) */
+  char *marker; /* Marker written over the tail for SB_TRUNC_MARKER ("..." if 0) */
 
 } sb;
 
+/* Truncation policy flags, combinable. Without any flag sb_term cuts at cap - 1. */
+#define SB_TRUNC_UTF8 1   /* Cut on a UTF-8 code point boundary */
+#define SB_TRUNC_LINE 2   /* Cut after the last complete line ('\n') if there is one */
+#define SB_TRUNC_MARKER 4 /* Replace the tail with the marker */
+
+#ifndef SB_TRUNC_LINE_WINDOW
+#define SB_TRUNC_LINE_WINDOW 256 /* SB_TRUNC_LINE looks this many bytes back for a '\n' */
+#endif
+
 typedef enum sb_pad_mode
 {
   SB_PAD_NONE = 0, /* No padding (default) */
@@ -45,6 +168,21 @@ typedef enum sb_pad_mode
 
 } sb_pad_mode;
 
+typedef enum sb_case
+{
+  SB_CASE_LOWER = 0, /* Lowercase hex digits "0-9a-f" (default) */
+  SB_CASE_UPPER      /* Uppercase hex digits "0-9A-F" */
+
+} sb_case;
+
+typedef enum sb_width_mode
+{
+  SB_WIDTH_BYTES = 0,  /* Width is the number of bytes (default) */
+  SB_WIDTH_CODEPOINTS, /* Width is the number of UTF-8 code points */
+  SB_WIDTH_COLUMNS     /* Width is the number of terminal columns (East Asian wide = 2) */
+
+} sb_width_mode;
+
 static unsigned long SB_LUT_POW10[10] = {
     1ul,
     10ul,
@@ -71,6 +209,105 @@ static char SB_LUT_DIGITS_2[] =
 
 static char SB_SPACES_64[] = "                                                                ";
 
+/* Byte to two hex chars: row is the high nibble, column (low nibble * 2) */
+static char SB_LUT_HEX_LOWER[16][33] = {
+    "000102030405060708090a0b0c0d0e0f",
+    "101112131415161718191a1b1c1d1e1f",
+    "202122232425262728292a2b2c2d2e2f",
+    "303132333435363738393a3b3c3d3e3f",
+    "404142434445464748494a4b4c4d4e4f",
+    "505152535455565758595a5b5c5d5e5f",
+    "606162636465666768696a6b6c6d6e6f",
+    "707172737475767778797a7b7c7d7e7f",
+    "808182838485868788898a8b8c8d8e8f",
+    "909192939495969798999a9b9c9d9e9f",
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf",
+    "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf",
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf",
+    "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf",
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeef",
+    "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff"};
+
+static char SB_LUT_HEX_UPPER[16][33] = {
+    "000102030405060708090A0B0C0D0E0F",
+    "101112131415161718191A1B1C1D1E1F",
+    "202122232425262728292A2B2C2D2E2F",
+    "303132333435363738393A3B3C3D3E3F",
+    "404142434445464748494A4B4C4D4E4F",
+    "505152535455565758595A5B5C5D5E5F",
+    "606162636465666768696A6B6C6D6E6F",
+    "707172737475767778797A7B7C7D7E7F",
+    "808182838485868788898A8B8C8D8E8F",
+    "909192939495969798999A9B9C9D9E9F",
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAF",
+    "B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF",
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF",
+    "D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF",
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF",
+    "F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF"};
+
+static char SB_LUT_BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static char SB_LUT_BASE64URL[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/* Base64 char to 6-bit value, -1 if invalid. Accepts both the standard and the URL alphabet. */
+static signed char SB_LUT_BASE64_DECODE[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, 62, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+
+/* JSON escape char per byte ('u' = \u00XX), 0 if the byte is copied verbatim */
+static char SB_LUT_JSON_ESCAPE[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0};
+
+#ifdef SB_KERNEL_SSSE3
+/* UTF-8 validation nibble tables (Keiser and Lemire). Error bits: 0x01 too short, 0x02 too long,
+ * 0x04 overlong 3, 0x08 too large, 0x10 surrogate, 0x20 overlong 2, 0x40 too large 1000 / overlong 4, 0x80 two continuations.
+ */
+static unsigned char SB_LUT_UTF8_BYTE_1_HIGH[16] = {0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x80, 0x80, 0x80, 0x80, 0x21, 0x01, 0x15, 0x49};
+static unsigned char SB_LUT_UTF8_BYTE_1_LOW[16] = {0xe7, 0xa3, 0x83, 0x83, 0x8b, 0xcb, 0xcb, 0xcb, 0xcb, 0xcb, 0xcb, 0xcb, 0xcb, 0xdb, 0xcb, 0xcb};
+static unsigned char SB_LUT_UTF8_BYTE_2_HIGH[16] = {0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0xe6, 0xae, 0xba, 0xba, 0x01, 0x01, 0x01, 0x01};
+#endif
+
+#define SB_ESCAPE_MARKUP 1 /* Byte must be escaped in HTML/XML text and attributes */
+#define SB_ESCAPE_URL 2    /* Byte is not RFC 3986 unreserved and gets percent-encoded */
+
+/* Escape class flags (SB_ESCAPE_*) per byte */
+static unsigned char SB_LUT_ESCAPE[256] = {
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 3, 2, 2, 2, 3, 3, 2, 2, 2, 2, 2, 0, 0, 2,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 3, 2, 3, 2,
+    2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 0,
+    2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 0, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2};
+
 SB_API SB_INLINE unsigned long sb_pow10u(int p)
 {
   if (p < 0)
@@ -86,12 +323,32 @@ SB_API SB_INLINE unsigned long sb_pow10u(int p)
   return SB_LUT_POW10[p];
 }
 
-SB_API SB_INLINE void sb_init(sb *sb, char *buffer, int capacity)
+/* Index of the lowest set bit, v must not be 0 */
+SB_API SB_INLINE int sb_ctz32(unsigned int v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctz(v);
+#else
+  int n = 0;
+
+  while (!(v & 1u))
+  {
+    v >>= 1;
+    n++;
+  }
+
+  return n;
+#endif
+}
+
+SB_API SB_INLINE void sb_init(sb *sb, char *buffer, sb_size capacity)
 {
   sb->buf = buffer;
   sb->cap = (capacity > 0) ? capacity : 0;
   sb->len = 0;
   sb->ovr = 0;
+  sb->trunc = 0;
+  sb->marker = 0;
 
   if (sb->cap > 0)
   {
@@ -99,6 +356,52 @@ SB_API SB_INLINE void sb_init(sb *sb, char *buffer, int capacity)
   }
 }
 
+/* Selects how sb_term truncates on overflow (SB_TRUNC_* flags). marker is used for SB_TRUNC_MARKER, 0 means "...". */
+SB_API SB_INLINE void sb_set_truncation(sb *sb, int policy, char *marker)
+{
+  sb->trunc = policy;
+  sb->marker = marker;
+}
+
+/* Returns the cut position for keeping at most "keep" bytes. Only the tail is inspected: at most
+ * 3 bytes for the UTF-8 boundary and SB_TRUNC_LINE_WINDOW bytes for SB_TRUNC_LINE. Without a '\n'
+ * in that window the line policy falls back to the others.
+ */
+SB_API SB_INLINE sb_size sb_truncate_pos(sb *sb, sb_size keep, int policy)
+{
+  sb_size cut = keep;
+
+  if (policy & SB_TRUNC_LINE)
+  {
+    sb_size stop = (keep > SB_TRUNC_LINE_WINDOW) ? keep - SB_TRUNC_LINE_WINDOW : 0;
+    sb_size i = keep;
+
+    while (i > stop && sb->buf[i - 1] != '\n')
+    {
+      i--;
+    }
+
+    if (i > stop)
+    {
+      return i;
+    }
+  }
+
+  if (policy & SB_TRUNC_UTF8)
+  {
+    /* Step back while the first dropped byte continues the sequence of a kept one */
+    int steps = 0;
+
+    while (cut > 0 && steps < 3 && (sb->buf[cut] & 0xc0) == 0x80)
+    {
+      cut--;
+      steps++;
+    }
+  }
+
+  return cut;
+}
+
 SB_API SB_INLINE void sb_term(sb *sb)
 {
   if (sb->cap == 0)
@@ -110,52 +413,94 @@ SB_API SB_INLINE void sb_term(sb *sb)
   {
     sb->buf[sb->len] = '\0';
   }
-  else
+  else if (sb->trunc == 0)
   {
     sb->buf[sb->cap - 1] = '\0';
     sb->ovr = 1;
     sb->len = sb->cap - 1;
   }
+  else
+  {
+    char *marker = (sb->trunc & SB_TRUNC_MARKER) ? (sb->marker ? sb->marker : "...") : "";
+    sb_size avail = sb->cap - 1;
+    sb_size mlen = 0;
+    sb_size cut;
+    sb_size i;
+
+    while (marker[mlen] != '\0')
+    {
+      mlen++;
+    }
+
+    if (mlen > avail)
+    {
+      mlen = avail;
+    }
+
+    cut = sb_truncate_pos(sb, avail - mlen, sb->trunc);
+
+    for (i = 0; i < mlen; ++i)
+    {
+      sb->buf[cut + i] = marker[i];
+    }
+
+    sb->len = cut + mlen;
+    sb->buf[sb->len] = '\0';
+    sb->ovr = 1;
+  }
+}
+
+/* Terminates with the given truncation policy (see sb_set_truncation) */
+SB_API SB_INLINE void sb_term_truncate(sb *sb, int policy, char *marker)
+{
+  sb_set_truncation(sb, policy, marker);
+  sb_term(sb);
 }
 
 SB_API SB_INLINE void sb_putc(sb *sb, char c)
 {
   if (sb->len < sb->cap)
   {
-    sb->buf[sb->len] = c;
+    sb->buf[sb->len++] = c;
   }
   else
   {
     sb->ovr = 1;
+
+    /* Keeps counting the required size, saturating instead of wrapping around */
+    if (sb->len < SB_SIZE_MAX)
+    {
+      sb->len++;
+    }
   }
-  sb->len++;
 }
 
-SB_API SB_INLINE void sb_append_bytes(sb *sb, char *src, int len)
+SB_API SB_INLINE void sb_append_bytes(sb *sb, char *src, sb_size len)
 {
-  int space = sb->cap - sb->len;
+  sb_size space = sb->cap - sb->len;
 
   if (space > 0)
   {
-    int copy = (len < space) ? len : space;
-    int i;
+    sb_size copy = (len < space) ? len : space;
+    sb_size i;
     for (i = 0; i < copy; ++i)
     {
       sb->buf[sb->len + i] = src[i];
     }
   }
 
-  sb->len += len;
-
   if (len > space)
   {
     sb->ovr = 1;
   }
+
+  /* The required size saturates at SB_SIZE_MAX instead of overflowing */
+  sb->len = (len > SB_SIZE_MAX - sb->len) ? SB_SIZE_MAX : sb->len + len;
 }
 
-SB_API SB_INLINE int sb_append_cstr(sb *sb, char *s)
+SB_API SB_INLINE sb_size sb_append_cstr(sb *sb, char *s)
 {
-  int n = 0;
+  sb_size n = 0;
 
   while (s[n] != '\0')
   {
@@ -469,137 +814,2433 @@ SB_API SB_INLINE int sb_append_float(sb *sb, float x, int width, int precision,
   return sb_append_double(sb, (double)x, width, precision, pad);
 }
 
-SB_API SB_INLINE int sb_cmp(sb *sb, char *s)
+/* #############################################################################
+ * # LINUX SYSCALLS
+ * #############################################################################
+ */
+/* Raw system calls so the file, thread and I/O helpers need no libc. They return -errno on failure. */
+#if defined(__linux__) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__aarch64__))
+#define SB_LINUX_SYSCALLS
+
+#if defined(__x86_64__)
+#define SB_SYS_READ 0
+#define SB_SYS_WRITE 1
+#define SB_SYS_CLOSE 3
+#define SB_SYS_LSEEK 8
+#define SB_SYS_MMAP 9
+#define SB_SYS_MUNMAP 11
+#define SB_SYS_WRITEV 20
+#define SB_SYS_FCNTL 72
+#define SB_SYS_SCHED_YIELD 24
+#define SB_SYS_MREMAP 25
+#define SB_SYS_MADVISE 28
+#define SB_SYS_CLONE 56
+#define SB_SYS_EXIT 60
+#define SB_SYS_FSYNC 74
+#define SB_SYS_FTRUNCATE 77
+#define SB_SYS_FUTEX 202
+#define SB_SYS_OPENAT 257
+#define SB_SYS_UNLINKAT 263
+#else
+#define SB_SYS_READ 63
+#define SB_SYS_WRITE 64
+#define SB_SYS_CLOSE 57
+#define SB_SYS_LSEEK 62
+#define SB_SYS_MMAP 222
+#define SB_SYS_MUNMAP 215
+#define SB_SYS_WRITEV 66
+#define SB_SYS_FCNTL 25
+#define SB_SYS_SCHED_YIELD 124
+#define SB_SYS_MREMAP 216
+#define SB_SYS_MADVISE 233
+#define SB_SYS_CLONE 220
+#define SB_SYS_EXIT 93
+#define SB_SYS_FSYNC 82
+#define SB_SYS_FTRUNCATE 46
+#define SB_SYS_FUTEX 98
+#define SB_SYS_OPENAT 56
+#define SB_SYS_UNLINKAT 35
+#endif
+#define SB_SYS_IO_URING_SETUP 425
+#define SB_SYS_IO_URING_ENTER 426
+#define SB_SYS_IO_URING_REGISTER 427
+
+#define SB_AT_FDCWD (-100)
+
+SB_API SB_INLINE long sb_syscall6(long nr, long a, long b, long c, long d, long e, long f)
 {
-  int i;
+#if defined(__x86_64__)
+  long ret;
+  register long r10 __asm__("r10") = d;
+  register long r8 __asm__("r8") = e;
+  register long r9 __asm__("r9") = f;
+  __asm__ __volatile__("syscall"
+                       : "=a"(ret)
+                       : "a"(nr), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9)
+                       : "rcx", "r11", "memory");
+  return ret;
+#else
+  register long x8 __asm__("x8") = nr;
+  register long x0 __asm__("x0") = a;
+  register long x1 __asm__("x1") = b;
+  register long x2 __asm__("x2") = c;
+  register long x3 __asm__("x3") = d;
+  register long x4 __asm__("x4") = e;
+  register long x5 __asm__("x5") = f;
+  __asm__ __volatile__("svc 0"
+                       : "+r"(x0)
+                       : "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5)
+                       : "memory", "cc");
+  return x0;
+#endif
+}
 
-  for (i = 0; i < sb->len && s[i] != '\0'; ++i)
-  {
-    unsigned char c1 = (unsigned char)sb->buf[i];
-    unsigned char c2 = (unsigned char)s[i];
+SB_API SB_INLINE long sb_syscall3(long nr, long a, long b, long c)
+{
+  return sb_syscall6(nr, a, b, c, 0, 0, 0);
+}
 
-    if (c1 != c2)
-    {
-      return c1 - c2;
-    }
-  }
+/* Syscall results in [-4095, -1] are errors (also for addresses returned by mmap / mremap) */
+SB_API SB_INLINE int sb_syscall_failed(long r)
+{
+  return r < 0 && r > -4096;
+}
+#endif
 
-  if (i < sb->len)
+/* #############################################################################
+ * # CPU FEATURES
+ * #############################################################################
+ */
+#define SB_CPU_SSE2 1       /* x86 SSE2 */
+#define SB_CPU_SSSE3 2      /* x86 SSSE3 (pshufb) */
+#define SB_CPU_SSE42 4      /* x86 SSE4.2 (crc32) */
+#define SB_CPU_AVX2 8       /* x86 AVX2, enabled by the OS */
+#define SB_CPU_AVX512 16    /* x86 AVX-512 F and BW, enabled by the OS */
+#define SB_CPU_NEON 32      /* AArch64 Advanced SIMD */
+#define SB_CPU_ARM_CRC32 64 /* AArch64 CRC32 instructions */
+
+/* Kernels above the compile time baseline. A null entry means the inline (scalar or baseline) path is used. */
+typedef struct sb_kernels
+{
+  unsigned int features;                                             /* SB_CPU_* set the kernels were selected for */
+  int (*base64_encode)(char *p, unsigned char *s, int n, int url);   /* Returns the input bytes consumed */
+  int (*base64_decode)(unsigned char *d, unsigned char *s, int n);   /* Returns the input chars consumed */
+  int (*utf8_validate)(unsigned char *u, int n);                     /* Returns 1 if valid */
+  unsigned int (*crc32c)(unsigned int crc, unsigned char *p, sb_size n); /* Without the pre and post inversion */
+
+} sb_kernels;
+
+static sb_kernels SB_KERNELS;
+static int SB_KERNELS_ONCE = 0;
+
+/* Defined after the kernels (see the end of the CRC32C section) */
+SB_API SB_INLINE void sb_cpu_dispatch(unsigned int features);
+
+#if (defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)) && \
+    (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define SB_CPU_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+SB_API SB_INLINE void sb_cpuid(unsigned int leaf, unsigned int sub, unsigned int r[4])
+{
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuidex(regs, (int)leaf, (int)sub);
+  r[0] = (unsigned int)regs[0];
+  r[1] = (unsigned int)regs[1];
+  r[2] = (unsigned int)regs[2];
+  r[3] = (unsigned int)regs[3];
+#else
+  __asm__ __volatile__("cpuid" : "=a"(r[0]), "=b"(r[1]), "=c"(r[2]), "=d"(r[3]) : "a"(leaf), "c"(sub));
+#endif
+}
+
+/* Low half of XCR0: register state the OS saves on context switches */
+SB_API SB_INLINE unsigned int sb_xgetbv0(void)
+{
+#if defined(_MSC_VER)
+  return (unsigned int)_xgetbv(0);
+#else
+  unsigned int lo;
+  unsigned int hi;
+  __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  (void)hi;
+  return lo;
+#endif
+}
+#endif
+
+#ifdef SB_DISPATCH_ARM
+/* AT_HWCAP from /proc/self/auxv, read with raw syscalls (openat, read, close) */
+SB_API SB_INLINE unsigned long sb_cpu_hwcap(void)
+{
+  unsigned long entry[2];
+  unsigned long hwcap = 0;
+  long fd = sb_syscall3(SB_SYS_OPENAT, SB_AT_FDCWD, (long)"/proc/self/auxv", 0);
+
+  if (fd < 0)
   {
-    return (unsigned char)sb->buf[i];
+    return 0;
   }
 
-  if (s[i] != '\0')
+  while (sb_syscall3(SB_SYS_READ, fd, (long)entry, (long)sizeof(entry)) == (long)sizeof(entry) && entry[0] != 0)
   {
-    return -(unsigned char)s[i];
+    if (entry[0] == 16ul)
+    {
+      hwcap = entry[1];
+      break;
+    }
   }
 
-  return 0;
+  sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+
+  return hwcap;
 }
+#endif
 
-SB_API SB_INLINE int sb_ncmp(sb *sb, char *s, int n)
+/* Probes the running CPU and returns its SB_CPU_* features */
+SB_API SB_INLINE unsigned int sb_cpu_probe(void)
 {
-  int i;
+  unsigned int f = 0;
 
-  for (i = 0; i < n && i < sb->len && s[i] != '\0'; ++i)
+#if defined(SB_CPU_X86)
+  unsigned int r[4];
+  unsigned int max;
+  unsigned int xcr0 = 0;
+
+  sb_cpuid(0, 0, r);
+  max = r[0];
+  sb_cpuid(1, 0, r);
+
+  f |= (r[3] & (1u << 26)) ? SB_CPU_SSE2 : 0u;
+  f |= (r[2] & (1u << 9)) ? SB_CPU_SSSE3 : 0u;
+  f |= (r[2] & (1u << 20)) ? SB_CPU_SSE42 : 0u;
+
+  /* OSXSAVE and AVX: the OS reports which vector registers it preserves */
+  if ((r[2] & (1u << 27)) && (r[2] & (1u << 28)))
   {
-    unsigned char c1 = (unsigned char)sb->buf[i];
-    unsigned char c2 = (unsigned char)s[i];
+    xcr0 = sb_xgetbv0();
+  }
 
-    if (c1 != c2)
+  if (max >= 7 && (xcr0 & 0x06u) == 0x06u)
+  {
+    sb_cpuid(7, 0, r);
+    f |= (r[1] & (1u << 5)) ? SB_CPU_AVX2 : 0u;
+
+    if ((xcr0 & 0xe6u) == 0xe6u && (r[1] & (1u << 16)) && (r[1] & (1u << 30)))
     {
-      return c1 - c2;
+      f |= SB_CPU_AVX512;
     }
   }
+#elif defined(__aarch64__)
+  f |= SB_CPU_NEON;
+#if defined(__ARM_FEATURE_CRC32)
+  f |= SB_CPU_ARM_CRC32;
+#elif defined(SB_DISPATCH_ARM)
+  f |= (sb_cpu_hwcap() & 128ul) ? SB_CPU_ARM_CRC32 : 0u; /* HWCAP_CRC32 */
+#endif
+#endif
+
+  return f;
+}
 
-  if (i == n)
-  {
-    return 0;
-  }
+/* SB_CPU_* features of the running CPU (probed once), or SB_CPU_PIN when defined at compile time
+ * to pin one implementation, e.g. -DSB_CPU_PIN=SB_CPU_SSE2 or -DSB_CPU_PIN=0 for the scalar kernels.
+ */
+SB_API SB_INLINE unsigned int sb_cpu_features(void)
+{
+#ifdef SB_CPU_PIN
+  return (unsigned int)(SB_CPU_PIN);
+#else
+  static unsigned int features;
+  static int once = 0;
 
-  if (i < sb->len)
+  if (sb_once(&once))
   {
-    return (unsigned char)sb->buf[i];
+    features = sb_cpu_probe();
+    sb_once_done(&once);
   }
 
-  if (s[i] != '\0')
+  return features;
+#endif
+}
+
+/* Kernel table, selected on first use. Concurrent first callers wait for the one that selects it. */
+SB_API SB_INLINE sb_kernels *sb_cpu_kernels(void)
+{
+  if (sb_once(&SB_KERNELS_ONCE))
   {
-    return -(unsigned char)s[i];
+    sb_cpu_dispatch(sb_cpu_features());
   }
 
-  return 0;
+  return &SB_KERNELS;
 }
 
 /* #############################################################################
- * # PRINTF like implementation
+ * # HEXADECIMAL, OCTAL AND BINARY
  * #############################################################################
  */
-SB_API SB_INLINE void sb_printf(sb *s, char *fmt, void **args, int argc)
+SB_API SB_INLINE sb_u64 sb_bswap64(sb_u64 v)
 {
-  int arg_idx = 0;
-  char *p = fmt;
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_bswap64(v);
+#else
+  v = ((v & SB_U64(0x00FF00FFul, 0x00FF00FFul)) << 8) | ((v >> 8) & SB_U64(0x00FF00FFul, 0x00FF00FFul));
+  v = ((v & SB_U64(0x0000FFFFul, 0x0000FFFFul)) << 16) | ((v >> 16) & SB_U64(0x0000FFFFul, 0x0000FFFFul));
+  return (v << 32) | (v >> 32);
+#endif
+}
 
-  if (argc <= 0)
+/* Number of significant bits (0 for v == 0) */
+SB_API SB_INLINE int sb_bit_length_u64(sb_u64 v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return v ? 64 - __builtin_clzll(v) : 0;
+#else
+  int n = 0;
+
+  while (v >= 256u)
   {
-    return;
+    v >>= 8;
+    n += 8;
   }
 
-  while (*p)
+  while (v)
   {
-    if (*p == '%' && *(p + 1))
-    {
-      int width = 0;
-      int precision = -1;
-      sb_pad_mode pad = SB_PAD_NONE;
+    v >>= 1;
+    n++;
+  }
 
-      ++p; /* skip '%' */
+  return n;
+#endif
+}
 
-      /* check left-pad flag */
-      if (*p == '-')
-      {
-        pad = SB_PAD_LEFT;
-        ++p;
-      }
+SB_API SB_INLINE int sb_count_digits_hex(sb_u64 v)
+{
+  int bits = sb_bit_length_u64(v);
+  return bits ? (bits + 3) >> 2 : 1;
+}
 
-      /* parse width */
-      while (*p >= '0' && *p <= '9')
-      {
-        width = width * 10 + (*p - '0');
-        ++p;
-      }
+/* Writes exactly 16 hex chars of v (most significant nibble first) to dst using the byte LUT */
+SB_API SB_INLINE void sb_hex16_scalar(char *dst, sb_u64 v, sb_case c)
+{
+  char(*lut)[33] = (c == SB_CASE_UPPER) ? SB_LUT_HEX_UPPER : SB_LUT_HEX_LOWER;
+  int i;
 
-      if (width > 0 && pad == SB_PAD_NONE)
-      {
-        pad = SB_PAD_RIGHT;
-      }
+  for (i = 0; i < 8; ++i)
+  {
+    unsigned int b = (unsigned int)(v >> (56 - 8 * i)) & 0xffu;
+    char *pair = &lut[b >> 4][(b & 15u) * 2u];
+    dst[2 * i] = pair[0];
+    dst[2 * i + 1] = pair[1];
+  }
+}
 
-      /* parse precision */
-      if (*p == '.')
-      {
-        ++p;
-        precision = 0;
+/* Same as sb_hex16_scalar but with a single 16 byte store when SIMD is available */
+SB_API SB_INLINE void sb_hex16(char *dst, sb_u64 v, sb_case c)
+{
+#ifdef SB_SIMD_SSE2
+  sb_u64 be = sb_bswap64(v);
+  __m128i x = _mm_loadl_epi64((__m128i *)(void *)&be);
+  __m128i mask = _mm_set1_epi8(0x0f);
+  __m128i lo = _mm_and_si128(x, mask);
+  __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+  __m128i nib = _mm_unpacklo_epi8(hi, lo);
+#ifdef SB_SIMD_SSSE3
+  __m128i lut = (c == SB_CASE_UPPER)
+                    ? _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F')
+                    : _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+  __m128i out = _mm_shuffle_epi8(lut, nib);
+#else
+  /* '0' + n, plus the gap to 'a'/'A' for nibbles above 9 */
+  __m128i gap = _mm_set1_epi8((char)(c == SB_CASE_UPPER ? 'A' - '0' - 10 : 'a' - '0' - 10));
+  __m128i above9 = _mm_cmpgt_epi8(nib, _mm_set1_epi8(9));
+  __m128i out = _mm_add_epi8(_mm_add_epi8(nib, _mm_set1_epi8('0')), _mm_and_si128(above9, gap));
+#endif
+  _mm_storeu_si128((__m128i *)(void *)dst, out);
+#else
+  sb_hex16_scalar(dst, v, c);
+#endif
+}
 
-        while (*p >= '0' && *p <= '9')
-        {
-          precision = precision * 10 + (*p - '0');
-          ++p;
-        }
-      }
+/* Appends the lowest "nibbles" (1..16) hex digits of v including leading zeros */
+SB_API SB_INLINE void sb_append_hex_digits(sb *sb, sb_u64 v, int nibbles, sb_case c)
+{
+  /* Shift the wanted digits to the top so the kernel emits them first */
+  sb_u64 top = (nibbles < 16) ? (v << (4 * (16 - nibbles))) : v;
 
-      switch (*p)
-      {
-      case 's':
-        sb_append_cstr_padded(s, (char *)args[arg_idx], width, pad);
-        break;
-      case 'd':
-        sb_append_long(s, *((long *)args[arg_idx]), width, pad);
-        break;
-      case 'u':
-        sb_append_ulong(s, *((unsigned long *)args[arg_idx]), width, pad);
-        break;
+  if (sb->cap - sb->len >= 16)
+  {
+    /* Fast path: one 16 byte store, the tail beyond len is simply overwritten later */
+    sb_hex16(sb->buf + sb->len, top, c);
+    sb->len += nibbles;
+  }
+  else
+  {
+    char tmp[16];
+    sb_hex16_scalar(tmp, top, c);
+    sb_append_bytes(sb, tmp, nibbles);
+  }
+}
+
+SB_API SB_INLINE int sb_append_hex_fixed(sb *sb, sb_u64 v, int nibbles, sb_case c)
+{
+  if (nibbles < 1)
+  {
+    nibbles = 1;
+  }
+
+  if (nibbles > 16)
+  {
+    /* Zero pad beyond the 64-bit value range */
+    int zeros = nibbles - 16;
+
+    while (zeros-- > 0)
+    {
+      sb_putc(sb, '0');
+    }
+
+    sb_append_hex_digits(sb, v, 16, c);
+    return nibbles;
+  }
+
+  sb_append_hex_digits(sb, v, nibbles, c);
+
+  return nibbles;
+}
+
+SB_API SB_INLINE int sb_append_hex(sb *sb, sb_u64 v, int width, sb_pad_mode pad, sb_case c)
+{
+  int digits = sb_count_digits_hex(v);
+
+  if (pad == SB_PAD_LEFT)
+  {
+    sb_append_spaces(sb, width - digits);
+  }
+
+  sb_append_hex_digits(sb, v, digits, c);
+
+  if (pad == SB_PAD_RIGHT)
+  {
+    sb_append_spaces(sb, width - digits);
+  }
+
+  return digits;
+}
+
+/* Encodes n bytes of src as 2 * n hex chars into dst */
+SB_API SB_INLINE void sb_hex_encode(char *dst, char *src, int n, sb_case c)
+{
+  char(*lut)[33] = (c == SB_CASE_UPPER) ? SB_LUT_HEX_UPPER : SB_LUT_HEX_LOWER;
+  unsigned char *s = (unsigned char *)src;
+  int i = 0;
+
+#ifdef SB_SIMD_SSE2
+  __m128i mask = _mm_set1_epi8(0x0f);
+#ifdef SB_SIMD_SSSE3
+  __m128i digits = (c == SB_CASE_UPPER)
+                       ? _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F')
+                       : _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+#else
+  __m128i gap = _mm_set1_epi8((char)(c == SB_CASE_UPPER ? 'A' - '0' - 10 : 'a' - '0' - 10));
+  __m128i nine = _mm_set1_epi8(9);
+  __m128i zero = _mm_set1_epi8('0');
+#endif
+
+  for (; i + 16 <= n; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((__m128i *)(void *)(s + i));
+    __m128i lo = _mm_and_si128(x, mask);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+    __m128i a = _mm_unpacklo_epi8(hi, lo);
+    __m128i b = _mm_unpackhi_epi8(hi, lo);
+#ifdef SB_SIMD_SSSE3
+    a = _mm_shuffle_epi8(digits, a);
+    b = _mm_shuffle_epi8(digits, b);
+#else
+    a = _mm_add_epi8(_mm_add_epi8(a, zero), _mm_and_si128(_mm_cmpgt_epi8(a, nine), gap));
+    b = _mm_add_epi8(_mm_add_epi8(b, zero), _mm_and_si128(_mm_cmpgt_epi8(b, nine), gap));
+#endif
+    _mm_storeu_si128((__m128i *)(void *)(dst + 2 * i), a);
+    _mm_storeu_si128((__m128i *)(void *)(dst + 2 * i + 16), b);
+  }
+#endif
+
+  for (; i < n; ++i)
+  {
+    char *pair = &lut[s[i] >> 4][(s[i] & 15u) * 2u];
+    dst[2 * i] = pair[0];
+    dst[2 * i + 1] = pair[1];
+  }
+}
+
+/* Appends n bytes as 2 * n hex characters. Returns the output length, SB_SIZE_MAX if it is not representable. */
+SB_API SB_INLINE sb_size sb_append_hex_bytes(sb *sb, char *src, int n, sb_case c)
+{
+  char tmp[128];
+  sb_size bytes = n;
+  sb_size out;
+
+  if (n <= 0)
+  {
+    return 0;
+  }
+
+  /* 2 * n overflows int for n > 1 GiB, the output can then never fit */
+  out = (bytes > SB_SIZE_MAX / 2) ? SB_SIZE_MAX : bytes * 2;
+
+  if (bytes <= SB_SIZE_MAX / 2 && sb->cap - sb->len >= out)
+  {
+    sb_hex_encode(sb->buf + sb->len, src, n, c);
+    sb->len += out;
+    return out;
+  }
+
+  /* Near capacity: encode in chunks and let sb_append_bytes handle the overflow */
+  {
+    int i;
+
+    for (i = 0; i < n; i += 64)
+    {
+      int chunk = (n - i < 64) ? (n - i) : 64;
+      sb_hex_encode(tmp, src + i, chunk, c);
+      sb_append_bytes(sb, tmp, 2 * chunk);
+    }
+  }
+
+  return out;
+}
+
+/* Classic "hexdump -C" layout, 16 bytes per line:
+ *
+ *   00000000  48 65 6c 6c 6f 20 57 6f  72 6c 64 0a              |Hello World.|
+ *
+ * Offsets start at base_offset and widen to 16 digits once they exceed 32 bits.
+ */
+SB_API SB_INLINE int sb_append_hexdump(sb *sb, char *src, int n, sb_u64 base_offset)
+{
+  unsigned char *s = (unsigned char *)src;
+  int offset_digits = ((base_offset + (sb_u64)(n > 0 ? n : 0)) >> 32) ? 16 : 8;
+  int line_max = offset_digits + 2 + 16 * 3 + 1 + 2 + 16 + 2;
+  int written = 0;
+  int i;
+
+  for (i = 0; i < n; i += 16)
+  {
+    char tmp[96];
+    char off[16];
+    char *dst;
+    char *p;
+    int line = (n - i < 16) ? (n - i) : 16;
+    int line_len;
+    int j;
+
+    /* One bounds check per line: write straight into the buffer when the longest line fits */
+    dst = (sb->cap - sb->len >= line_max) ? sb->buf + sb->len : tmp;
+    p = dst;
+
+    sb_hex16_scalar(off, (base_offset + (sb_u64)i) << (4 * (16 - offset_digits)), SB_CASE_LOWER);
+    for (j = 0; j < offset_digits; ++j)
+    {
+      *p++ = off[j];
+    }
+    *p++ = ' ';
+    *p++ = ' ';
+
+    for (j = 0; j < 16; ++j)
+    {
+      if (j < line)
+      {
+        char *pair = &SB_LUT_HEX_LOWER[s[i + j] >> 4][(s[i + j] & 15u) * 2u];
+        p[0] = pair[0];
+        p[1] = pair[1];
+      }
+      else
+      {
+        p[0] = ' ';
+        p[1] = ' ';
+      }
+      p[2] = ' ';
+      p += 3;
+
+      if (j == 7)
+      {
+        *p++ = ' ';
+      }
+    }
+
+    *p++ = ' ';
+    *p++ = '|';
+
+    for (j = 0; j < line; ++j)
+    {
+      unsigned char b = s[i + j];
+      *p++ = (b >= 0x20 && b < 0x7f) ? (char)b : '.';
+    }
+
+    *p++ = '|';
+    *p++ = '\n';
+
+    line_len = (int)(p - dst);
+
+    if (dst == tmp)
+    {
+      sb_append_bytes(sb, tmp, line_len);
+    }
+    else
+    {
+      sb->len += line_len;
+    }
+
+    written += line_len;
+  }
+
+  return written;
+}
+
+SB_API SB_INLINE int sb_append_oct(sb *sb, sb_u64 v, int width, sb_pad_mode pad)
+{
+  char tmp[22]; /* 64 bits / 3 bits per digit */
+  char *p = tmp + sizeof(tmp);
+  int digits;
+
+  do
+  {
+    *--p = (char)('0' + (int)(v & 7u));
+    v >>= 3;
+  } while (v);
+
+  digits = (int)((tmp + sizeof(tmp)) - p);
+
+  if (pad == SB_PAD_LEFT)
+  {
+    sb_append_spaces(sb, width - digits);
+  }
+
+  sb_append_bytes(sb, p, digits);
+
+  if (pad == SB_PAD_RIGHT)
+  {
+    sb_append_spaces(sb, width - digits);
+  }
+
+  return digits;
+}
+
+SB_API SB_INLINE int sb_append_bin(sb *sb, sb_u64 v, int width, sb_pad_mode pad)
+{
+  char tmp[64];
+  int digits = sb_bit_length_u64(v);
+  int i;
+
+  if (digits == 0)
+  {
+    digits = 1;
+  }
+
+  for (i = 0; i < digits; ++i)
+  {
+    tmp[i] = (char)('0' + (int)((v >> (digits - 1 - i)) & 1u));
+  }
+
+  if (pad == SB_PAD_LEFT)
+  {
+    sb_append_spaces(sb, width - digits);
+  }
+
+  sb_append_bytes(sb, tmp, digits);
+
+  if (pad == SB_PAD_RIGHT)
+  {
+    sb_append_spaces(sb, width - digits);
+  }
+
+  return digits;
+}
+
+/* #############################################################################
+ * # BASE64
+ * #############################################################################
+ */
+SB_API SB_INLINE int sb_base64_encoded_len(int n, int url)
+{
+  /* The URL variant is emitted without '=' padding */
+  return url ? (n * 4 + 2) / 3 : ((n + 2) / 3) * 4;
+}
+
+#ifdef SB_KERNEL_SSSE3
+/* Encodes whole 12 byte groups while 16 input bytes are readable. Returns the input bytes consumed. */
+SB_API SB_INLINE SB_TARGET("ssse3") int sb_base64_encode_ssse3(char *p, unsigned char *s, int n, int url)
+{
+  /* 12 input bytes to 16 chars per iteration (W. Mula's pshufb method), reads 16 bytes */
+  __m128i shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  __m128i shift_lut = url
+                          ? _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0)
+                          : _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  int i = 0;
+
+  for (; i + 16 <= n; i += 12)
+  {
+    __m128i in = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(void *)(s + i)), shuf);
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    __m128i idx = _mm_or_si128(t0, t1);
+    __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+    r = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, r), idx);
+    _mm_storeu_si128((__m128i *)(void *)p, r);
+    p += 16;
+  }
+
+  return i;
+}
+#endif
+
+/* Encodes n bytes of src into dst which must hold sb_base64_encoded_len(n, url) chars */
+SB_API SB_INLINE int sb_base64_encode(char *dst, char *src, int n, int url)
+{
+  unsigned char *s = (unsigned char *)src;
+  char *lut = url ? SB_LUT_BASE64URL : SB_LUT_BASE64;
+  char *p = dst;
+  int i = 0;
+
+  if (sb_cpu_kernels()->base64_encode)
+  {
+    i = sb_cpu_kernels()->base64_encode(p, s, n, url);
+    p += (i / 3) * 4;
+  }
+
+  for (; i + 3 <= n; i += 3)
+  {
+    unsigned long v = ((unsigned long)s[i] << 16) | ((unsigned long)s[i + 1] << 8) | (unsigned long)s[i + 2];
+    p[0] = lut[(v >> 18) & 63u];
+    p[1] = lut[(v >> 12) & 63u];
+    p[2] = lut[(v >> 6) & 63u];
+    p[3] = lut[v & 63u];
+    p += 4;
+  }
+
+  if (i < n)
+  {
+    unsigned long v = (unsigned long)s[i] << 16;
+
+    if (i + 1 < n)
+    {
+      v |= (unsigned long)s[i + 1] << 8;
+    }
+
+    *p++ = lut[(v >> 18) & 63u];
+    *p++ = lut[(v >> 12) & 63u];
+
+    if (i + 1 < n)
+    {
+      *p++ = lut[(v >> 6) & 63u];
+    }
+    else if (!url)
+    {
+      *p++ = '=';
+    }
+
+    if (!url)
+    {
+      *p++ = '=';
+    }
+  }
+
+  return (int)(p - dst);
+}
+
+#ifdef SB_KERNEL_SSSE3
+/* Decodes 16 standard alphabet chars per iteration into d. Returns the input chars consumed. */
+SB_API SB_INLINE SB_TARGET("ssse3") int sb_base64_decode_ssse3(unsigned char *d, unsigned char *s, int n)
+{
+  /* 16 chars to 12 bytes per iteration. Validation and lookup use nibble LUTs (W. Mula).
+   * Each store writes 16 bytes, so stop while at least 8 chars (>= 4 output bytes) remain.
+   */
+  __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  __m128i mask_2f = _mm_set1_epi8(0x2f);
+  __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  int i = 0;
+
+  while (i + 24 <= n)
+  {
+    __m128i in = _mm_loadu_si128((__m128i *)(void *)(s + i));
+    __m128i hi_nib = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(in, mask_2f));
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nib);
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff)
+    {
+      /* Non standard char (URL alphabet, padding or invalid), finish with the scalar path */
+      break;
+    }
+
+    in = _mm_add_epi8(in, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(in, mask_2f), hi_nib)));
+    in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128((__m128i *)(void *)d, _mm_shuffle_epi8(in, pack));
+
+    i += 16;
+    d += 12;
+  }
+
+  return i;
+}
+#endif
+
+/* Decodes n chars of src (standard or URL alphabet, padding optional) into dst
+ * which must hold (n / 4) * 3 + 2 bytes. Returns the decoded length or -1 on invalid input.
+ */
+SB_API SB_INLINE int sb_base64_decode(char *dst, char *src, int n)
+{
+  unsigned char *s = (unsigned char *)src;
+  unsigned char *d = (unsigned char *)dst;
+  int i = 0;
+  int tail;
+
+  /* Strip up to two '=' padding chars, padded input must be a multiple of 4 */
+  if (n > 0 && s[n - 1] == '=')
+  {
+    if (n & 3)
+    {
+      return -1;
+    }
+
+    n -= (n > 1 && s[n - 2] == '=') ? 2 : 1;
+  }
+
+  if ((n & 3) == 1)
+  {
+    return -1;
+  }
+
+  if (sb_cpu_kernels()->base64_decode)
+  {
+    i = sb_cpu_kernels()->base64_decode(d, s, n);
+    d += (i / 4) * 3;
+  }
+
+  for (; i + 4 <= n; i += 4)
+  {
+    int a = SB_LUT_BASE64_DECODE[s[i]];
+    int b = SB_LUT_BASE64_DECODE[s[i + 1]];
+    int c = SB_LUT_BASE64_DECODE[s[i + 2]];
+    int e = SB_LUT_BASE64_DECODE[s[i + 3]];
+    unsigned long v;
+
+    if ((a | b | c | e) < 0)
+    {
+      return -1;
+    }
+
+    v = ((unsigned long)a << 18) | ((unsigned long)b << 12) | ((unsigned long)c << 6) | (unsigned long)e;
+    d[0] = (unsigned char)(v >> 16);
+    d[1] = (unsigned char)(v >> 8);
+    d[2] = (unsigned char)v;
+    d += 3;
+  }
+
+  tail = n - i;
+
+  if (tail >= 2)
+  {
+    int a = SB_LUT_BASE64_DECODE[s[i]];
+    int b = SB_LUT_BASE64_DECODE[s[i + 1]];
+    int c = (tail == 3) ? SB_LUT_BASE64_DECODE[s[i + 2]] : 0;
+    unsigned long v;
+
+    if ((a | b | c) < 0)
+    {
+      return -1;
+    }
+
+    v = ((unsigned long)a << 18) | ((unsigned long)b << 12) | ((unsigned long)c << 6);
+    *d++ = (unsigned char)(v >> 16);
+
+    if (tail == 3)
+    {
+      *d++ = (unsigned char)(v >> 8);
+    }
+  }
+
+  return (int)(d - (unsigned char *)dst);
+}
+
+SB_API SB_INLINE int sb_append_base64_internal(sb *sb, char *src, int n, int url)
+{
+  int out = sb_base64_encoded_len(n, url);
+
+  if (n <= 0)
+  {
+    return 0;
+  }
+
+  if (sb->cap - sb->len >= out)
+  {
+    sb_base64_encode(sb->buf + sb->len, src, n, url);
+    sb->len += out;
+  }
+  else
+  {
+    /* Near capacity: encode 48 byte chunks (no padding until the last one) */
+    char tmp[64];
+    int i;
+
+    for (i = 0; i < n; i += 48)
+    {
+      int chunk = (n - i < 48) ? (n - i) : 48;
+      sb_append_bytes(sb, tmp, sb_base64_encode(tmp, src + i, chunk, url));
+    }
+  }
+
+  return out;
+}
+
+SB_API SB_INLINE int sb_append_base64(sb *sb, char *src, int n)
+{
+  return sb_append_base64_internal(sb, src, n, 0);
+}
+
+SB_API SB_INLINE int sb_append_base64url(sb *sb, char *src, int n)
+{
+  return sb_append_base64_internal(sb, src, n, 1);
+}
+
+/* Appends the decoded bytes of a standard or URL Base64 string.
+ * Returns the number of bytes appended or -1 (builder unchanged) on invalid input.
+ */
+SB_API SB_INLINE int sb_append_base64_decoded(sb *sb, char *src, int n)
+{
+  sb_size start = sb->len;
+  int ovr = sb->ovr;
+  int written = 0;
+  int i;
+
+  if (n <= 0)
+  {
+    return 0;
+  }
+
+  if (sb->cap - sb->len >= (n / 4) * 3 + 2)
+  {
+    written = sb_base64_decode(sb->buf + sb->len, src, n);
+
+    if (written > 0)
+    {
+      sb->len += written;
+    }
+
+    return written;
+  }
+
+  /* Near capacity: decode 64 char chunks, padding can only occur in the last one */
+  for (i = 0; i < n; i += 64)
+  {
+    char tmp[50];
+    int chunk = (n - i < 64) ? (n - i) : 64;
+    int r = sb_base64_decode(tmp, src + i, chunk);
+
+    if (r < 0 || (r != 48 && i + chunk < n))
+    {
+      sb->len = start;
+      sb->ovr = ovr;
+      return -1;
+    }
+
+    sb_append_bytes(sb, tmp, r);
+    written += r;
+  }
+
+  return written;
+}
+
+/* #############################################################################
+ * # UTF-8
+ * #############################################################################
+ */
+SB_API SB_INLINE int sb_popcount32(unsigned int v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcount(v);
+#else
+  v = v - ((v >> 1) & 0x55555555u);
+  v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+  return (int)((((v + (v >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24);
+#endif
+}
+
+/* Returns the index of the first non-ASCII byte at or after i, n if none */
+SB_API SB_INLINE int sb_ascii_run(unsigned char *u, int i, int n)
+{
+#ifdef SB_SIMD_SSE2
+  SB_LAUNDER(u);
+
+  for (; i + 16 <= n; i += 16)
+  {
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((__m128i *)(void *)(u + i)));
+
+    if (mask)
+    {
+      return i + sb_ctz32(mask);
+    }
+  }
+#endif
+
+  while (i < n && u[i] < 0x80)
+  {
+    i++;
+  }
+
+  return i;
+}
+
+/* Validates one multi-byte sequence starting at u[i] (u[i] >= 0x80). Returns its length or 0 if invalid. */
+SB_API SB_INLINE int sb_utf8_sequence(unsigned char *u, int i, int n)
+{
+  unsigned char c = u[i];
+  int len;
+  int k;
+
+  if (c >= 0xc2 && c <= 0xdf)
+  {
+    len = 2;
+  }
+  else if ((c & 0xf0) == 0xe0)
+  {
+    len = 3;
+  }
+  else if (c >= 0xf0 && c <= 0xf4)
+  {
+    len = 4;
+  }
+  else
+  {
+    return 0; /* continuation, overlong 2 byte lead or out of range */
+  }
+
+  if (i + len > n)
+  {
+    return 0;
+  }
+
+  for (k = 1; k < len; ++k)
+  {
+    if ((u[i + k] & 0xc0) != 0x80)
+    {
+      return 0;
+    }
+  }
+
+  /* Overlong 3/4 byte forms, UTF-16 surrogates and code points above U+10FFFF */
+  if ((c == 0xe0 && u[i + 1] < 0xa0) || (c == 0xed && u[i + 1] >= 0xa0) ||
+      (c == 0xf0 && u[i + 1] < 0x90) || (c == 0xf4 && u[i + 1] >= 0x90))
+  {
+    return 0;
+  }
+
+  return len;
+}
+
+#ifdef SB_KERNEL_SSSE3
+/* Lookup based UTF-8 validation of a 16 byte block (Keiser and Lemire, "Validating UTF-8 In Less Than One
+ * Instruction Per Byte"). prev is the previous block, the returned vector is non zero on error.
+ */
+SB_API SB_INLINE SB_TARGET("ssse3") __m128i sb_utf8_check_block(__m128i in, __m128i prev)
+{
+  __m128i nib = _mm_set1_epi8(0x0f);
+  __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+  __m128i prev2 = _mm_alignr_epi8(in, prev, 14);
+  __m128i prev3 = _mm_alignr_epi8(in, prev, 13);
+  __m128i byte_1_high = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(void *)SB_LUT_UTF8_BYTE_1_HIGH),
+                                         _mm_and_si128(_mm_srli_epi16(prev1, 4), nib));
+  __m128i byte_1_low = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(void *)SB_LUT_UTF8_BYTE_1_LOW),
+                                        _mm_and_si128(prev1, nib));
+  __m128i byte_2_high = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(void *)SB_LUT_UTF8_BYTE_2_HIGH),
+                                         _mm_and_si128(_mm_srli_epi16(in, 4), nib));
+  __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+  /* Third and fourth bytes of 3/4 byte sequences must be continuations */
+  __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80))),
+                                _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80))));
+  __m128i must23_80 = _mm_and_si128(must23, _mm_set1_epi8(-128));
+
+  return _mm_xor_si128(must23_80, special);
+}
+
+SB_API SB_INLINE SB_TARGET("ssse3") int sb_utf8_validate_ssse3(unsigned char *u, int n)
+{
+  __m128i prev = _mm_setzero_si128();
+  __m128i err = _mm_setzero_si128();
+  __m128i incomplete = _mm_setzero_si128();
+  /* A lead byte in the last 1-3 positions still expects continuation bytes */
+  __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                              (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+  unsigned char tail[16];
+  int i = 0;
+
+  for (;;)
+  {
+    __m128i in;
+    int k;
+
+    if (i + 16 <= n)
+    {
+      in = _mm_loadu_si128((__m128i *)(void *)(u + i));
+    }
+    else if (i < n)
+    {
+      for (k = 0; k < 16; ++k)
+      {
+        tail[k] = (unsigned char)(i + k < n ? u[i + k] : 0);
+      }
+      in = _mm_loadu_si128((__m128i *)(void *)tail);
+    }
+    else
+    {
+      break;
+    }
+
+    if (_mm_movemask_epi8(in) == 0)
+    {
+      /* ASCII block, only a sequence left open by the previous block can be wrong */
+      err = _mm_or_si128(err, incomplete);
+      incomplete = _mm_setzero_si128();
+    }
+    else
+    {
+      err = _mm_or_si128(err, sb_utf8_check_block(in, prev));
+      incomplete = _mm_subs_epu8(in, max);
+    }
+
+    prev = in;
+    i += 16;
+  }
+
+  err = _mm_or_si128(err, incomplete);
+
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128())) == 0xffff;
+}
+#endif
+
+/* Returns 1 if s holds n bytes of well-formed UTF-8, 0 otherwise */
+SB_API SB_INLINE int sb_utf8_validate(char *s, int n)
+{
+  unsigned char *u = (unsigned char *)s;
+  int i = 0;
+
+  if (sb_cpu_kernels()->utf8_validate)
+  {
+    return sb_cpu_kernels()->utf8_validate(u, n);
+  }
+
+  while (i < n)
+  {
+    int len;
+
+    i = sb_ascii_run(u, i, n);
+
+    if (i == n)
+    {
+      break;
+    }
+
+    len = sb_utf8_sequence(u, i, n);
+
+    if (len == 0)
+    {
+      return 0;
+    }
+
+    i += len;
+  }
+
+  return 1;
+}
+
+/* Number of code points (bytes that are not continuation bytes) */
+SB_API SB_INLINE int sb_utf8_count(char *s, int n)
+{
+  unsigned char *u = (unsigned char *)s;
+  int conts = 0;
+  int i = 0;
+
+#ifdef SB_SIMD_SSE2
+  __m128i limit = _mm_set1_epi8(-64); /* 0xc0, continuation bytes are 0x80..0xbf */
+
+  SB_LAUNDER(u);
+
+  for (; i + 16 <= n; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((__m128i *)(void *)(u + i));
+    conts += sb_popcount32((unsigned int)_mm_movemask_epi8(_mm_cmplt_epi8(x, limit)));
+  }
+#endif
+
+  for (; i < n; ++i)
+  {
+    conts += (u[i] & 0xc0) == 0x80;
+  }
+
+  return n - conts;
+}
+
+/* Returns 1 for East Asian wide and fullwidth code points which occupy two terminal columns */
+SB_API SB_INLINE int sb_codepoint_is_wide(unsigned long cp)
+{
+  return cp >= 0x1100ul &&
+         (cp <= 0x115ful ||                    /* Hangul Jamo */
+          (cp >= 0x2e80ul && cp <= 0xa4cful && /* CJK ... Yi */
+           cp != 0x303ful) ||
+          (cp >= 0xac00ul && cp <= 0xd7a3ul) ||   /* Hangul Syllables */
+          (cp >= 0xf900ul && cp <= 0xfafful) ||   /* CJK Compatibility Ideographs */
+          (cp >= 0xfe30ul && cp <= 0xfe4ful) ||   /* CJK Compatibility Forms */
+          (cp >= 0xff00ul && cp <= 0xff60ul) ||   /* Fullwidth Forms */
+          (cp >= 0xffe0ul && cp <= 0xffe6ul) ||   /* Fullwidth Signs */
+          (cp >= 0x1f300ul && cp <= 0x1f64ful) || /* Pictographs and Emoticons */
+          (cp >= 0x1f900ul && cp <= 0x1f9fful) || /* Supplemental Symbols and Pictographs */
+          (cp >= 0x20000ul && cp <= 0x3fffdul));  /* CJK Extension B and later */
+}
+
+/* Width of s in the given mode: bytes, code points or terminal columns (East Asian wide = 2) */
+SB_API SB_INLINE int sb_text_width(char *s, int n, sb_width_mode mode)
+{
+  unsigned char *u = (unsigned char *)s;
+  int width = 0;
+  int i = 0;
+
+  if (mode == SB_WIDTH_BYTES)
+  {
+    return n;
+  }
+
+  if (mode == SB_WIDTH_CODEPOINTS)
+  {
+    return sb_utf8_count(s, n);
+  }
+
+  while (i < n)
+  {
+    int run = sb_ascii_run(u, i, n);
+    int len;
+    unsigned long cp;
+
+    width += run - i;
+    i = run;
+
+    if (i == n)
+    {
+      break;
+    }
+
+    len = sb_utf8_sequence(u, i, n);
+
+    if (len == 0)
+    {
+      /* Invalid byte, count it as one column */
+      width++;
+      i++;
+      continue;
+    }
+
+    cp = (unsigned long)(u[i] & (0x7f >> len));
+
+    for (run = 1; run < len; ++run)
+    {
+      cp = (cp << 6) | (unsigned long)(u[i + run] & 0x3f);
+    }
+
+    width += 1 + sb_codepoint_is_wide(cp);
+    i += len;
+  }
+
+  return width;
+}
+
+SB_API SB_INLINE int sb_append_cstr_padded_width(sb *sb, char *s, int width, sb_pad_mode pad, sb_width_mode mode)
+{
+  int n = 0;
+  int w;
+
+  while (s[n] != '\0')
+  {
+    n++;
+  }
+
+  w = (pad == SB_PAD_NONE) ? n : sb_text_width(s, n, mode);
+
+  if (pad == SB_PAD_LEFT && width > w)
+  {
+    sb_append_spaces(sb, width - w);
+  }
+
+  sb_append_bytes(sb, s, n);
+
+  if (pad == SB_PAD_RIGHT && width > w)
+  {
+    sb_append_spaces(sb, width - w);
+  }
+
+  return (width > w) ? width : w;
+}
+
+/* #############################################################################
+ * # UTF-16
+ * #############################################################################
+ */
+/* Encodes code point cp as UTF-8 into p, returns the number of bytes (1..4) */
+SB_API SB_INLINE int sb_utf8_encode(char *p, unsigned long cp)
+{
+  if (cp < 0x80ul)
+  {
+    p[0] = (char)cp;
+    return 1;
+  }
+
+  if (cp < 0x800ul)
+  {
+    p[0] = (char)(0xc0ul | (cp >> 6));
+    p[1] = (char)(0x80ul | (cp & 0x3ful));
+    return 2;
+  }
+
+  if (cp < 0x10000ul)
+  {
+    p[0] = (char)(0xe0ul | (cp >> 12));
+    p[1] = (char)(0x80ul | ((cp >> 6) & 0x3ful));
+    p[2] = (char)(0x80ul | (cp & 0x3ful));
+    return 3;
+  }
+
+  p[0] = (char)(0xf0ul | (cp >> 18));
+  p[1] = (char)(0x80ul | ((cp >> 12) & 0x3ful));
+  p[2] = (char)(0x80ul | ((cp >> 6) & 0x3ful));
+  p[3] = (char)(0x80ul | (cp & 0x3ful));
+  return 4;
+}
+
+/* Decodes the code point of the UTF-16 unit(s) at src[i], unpaired surrogates become U+FFFD */
+SB_API SB_INLINE unsigned long sb_utf16_decode(unsigned short *src, int *i, int n)
+{
+  unsigned long cp = src[*i];
+
+  (*i)++;
+
+  if (cp >= 0xd800ul && cp <= 0xdffful)
+  {
+    if (cp <= 0xdbfful && *i < n && src[*i] >= 0xdc00u && src[*i] <= 0xdfffu)
+    {
+      cp = 0x10000ul + ((cp - 0xd800ul) << 10) + ((unsigned long)src[*i] - 0xdc00ul);
+      (*i)++;
+    }
+    else
+    {
+      cp = 0xfffdul;
+    }
+  }
+
+  return cp;
+}
+
+/* Appends n UTF-16 code units (e.g. a Win32 wide string) as UTF-8. Returns the number of bytes appended. */
+SB_API SB_INLINE sb_size sb_append_utf16(sb *sb, unsigned short *src, int n)
+{
+  sb_size start = sb->len;
+  int i = 0;
+
+  /* Fast path: worst case of 3 bytes per code unit fits, write straight into the buffer */
+  if ((sb->cap - sb->len) / 3 > n)
+  {
+    char *dst = sb->buf + sb->len;
+
+    while (i < n)
+    {
+#ifdef SB_SIMD_SSE2
+      __m128i high = _mm_set1_epi16(-128); /* 0xff80 */
+
+      /* 8 ASCII code units at a time: pack the low bytes with a single 8 byte store */
+      while (i + 8 <= n)
+      {
+        __m128i x = _mm_loadu_si128((__m128i *)(void *)(src + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(x, high), _mm_setzero_si128())) != 0xffff)
+        {
+          break;
+        }
+
+        _mm_storel_epi64((__m128i *)(void *)dst, _mm_packus_epi16(x, x));
+        dst += 8;
+        i += 8;
+      }
+
+      if (i == n)
+      {
+        break;
+      }
+#endif
+      dst += sb_utf8_encode(dst, sb_utf16_decode(src, &i, n));
+    }
+
+    sb->len = (sb_size)(dst - sb->buf);
+  }
+  else
+  {
+    while (i < n)
+    {
+      char tmp[4];
+      sb_append_bytes(sb, tmp, sb_utf8_encode(tmp, sb_utf16_decode(src, &i, n)));
+    }
+  }
+
+  return sb->len - start;
+}
+
+/* Converts n bytes of UTF-8 to UTF-16 into dst (capacity in code units). Invalid bytes become U+FFFD.
+ * Like sb, it returns the full number of code units needed even if dst was too small.
+ */
+SB_API SB_INLINE int sb_utf8_to_utf16(char *src, int n, unsigned short *dst, int cap)
+{
+  unsigned char *u = (unsigned char *)src;
+  int w = 0;
+  int i = 0;
+
+  while (i < n)
+  {
+    unsigned long cp;
+    int len;
+
+#ifdef SB_SIMD_SSE2
+    /* 16 ASCII bytes at a time: zero extend to two 8 unit stores */
+    while (i + 16 <= n && w + 16 <= cap)
+    {
+      __m128i x = _mm_loadu_si128((__m128i *)(void *)(u + i));
+
+      if (_mm_movemask_epi8(x))
+      {
+        break;
+      }
+
+      _mm_storeu_si128((__m128i *)(void *)(dst + w), _mm_unpacklo_epi8(x, _mm_setzero_si128()));
+      _mm_storeu_si128((__m128i *)(void *)(dst + w + 8), _mm_unpackhi_epi8(x, _mm_setzero_si128()));
+      i += 16;
+      w += 16;
+    }
+
+    if (i == n)
+    {
+      break;
+    }
+#endif
+
+    if (u[i] < 0x80)
+    {
+      cp = u[i++];
+    }
+    else if ((len = sb_utf8_sequence(u, i, n)) == 0)
+    {
+      cp = 0xfffdul;
+      i++;
+    }
+    else
+    {
+      int k;
+
+      cp = (unsigned long)(u[i] & (0x7f >> len));
+
+      for (k = 1; k < len; ++k)
+      {
+        cp = (cp << 6) | (unsigned long)(u[i + k] & 0x3f);
+      }
+
+      i += len;
+    }
+
+    if (cp >= 0x10000ul)
+    {
+      if (w + 1 < cap)
+      {
+        dst[w] = (unsigned short)(0xd800ul + ((cp - 0x10000ul) >> 10));
+        dst[w + 1] = (unsigned short)(0xdc00ul + ((cp - 0x10000ul) & 0x3fful));
+      }
+      w += 2;
+    }
+    else
+    {
+      if (w < cap)
+      {
+        dst[w] = (unsigned short)cp;
+      }
+      w++;
+    }
+  }
+
+  return w;
+}
+
+/* Converts the builder content to a null terminated UTF-16 string (e.g. for Win32 wide APIs).
+ * Returns the number of code units without the terminator, dst is only complete if that is < cap.
+ * With SB_WIDE it returns -1 for content beyond 2 GB.
+ */
+SB_API SB_INLINE int sb_to_utf16(sb *sb, unsigned short *dst, int cap)
+{
+  sb_size len = (sb->len < sb->cap) ? sb->len : sb->cap;
+  int w;
+
+#ifdef SB_WIDE
+  /* UTF-16 strings are int sized (Win32 wide APIs) */
+  if (len > 2147483647)
+  {
+    return -1;
+  }
+#endif
+
+  w = sb_utf8_to_utf16(sb->buf, (int)len, dst, cap);
+
+  if (cap > 0)
+  {
+    dst[(w < cap) ? w : cap - 1] = 0;
+  }
+
+  return w;
+}
+
+/* #############################################################################
+ * # HASHING
+ * #############################################################################
+ */
+/* 64x64 -> 128 bit multiply, low half in *a and high half in *b */
+SB_API SB_INLINE void sb_mum(sb_u64 *a, sb_u64 *b)
+{
+#if defined(__SIZEOF_INT128__)
+  __extension__ unsigned __int128 r = (unsigned __int128)*a * *b;
+  *a = (sb_u64)r;
+  *b = (sb_u64)(r >> 64);
+#else
+  sb_u64 ha = *a >> 32;
+  sb_u64 hb = *b >> 32;
+  sb_u64 la = *a & 0xfffffffful;
+  sb_u64 lb = *b & 0xfffffffful;
+  sb_u64 rh = ha * hb;
+  sb_u64 rm0 = ha * lb;
+  sb_u64 rm1 = hb * la;
+  sb_u64 rl = la * lb;
+  sb_u64 t = rl + (rm0 << 32);
+  sb_u64 c = t < rl;
+  sb_u64 lo = t + (rm1 << 32);
+  c += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+SB_API SB_INLINE sb_u64 sb_mix(sb_u64 a, sb_u64 b)
+{
+  sb_mum(&a, &b);
+  return a ^ b;
+}
+
+/* Little endian loads, compilers turn these into single loads */
+SB_API SB_INLINE sb_u64 sb_read32le(unsigned char *p)
+{
+  return (sb_u64)p[0] | ((sb_u64)p[1] << 8) | ((sb_u64)p[2] << 16) | ((sb_u64)p[3] << 24);
+}
+
+SB_API SB_INLINE sb_u64 sb_read64le(unsigned char *p)
+{
+  return sb_read32le(p) | (sb_read32le(p + 4) << 32);
+}
+
+#define SB_HASH_P0 SB_U64(0x2d358dccul, 0xaa6c78a5ul)
+#define SB_HASH_P1 SB_U64(0x8bb84b93ul, 0x962eacc9ul)
+#define SB_HASH_P2 SB_U64(0x4b33a62eul, 0xd433d4a3ul)
+#define SB_HASH_P3 SB_U64(0x4d5a2da5ul, 0x1de1aa47ul)
+
+/* Streaming state. The input stays in the builder buffer, so only the 48 byte block lanes are kept. */
+typedef struct sb_hash_state
+{
+  sb_u64 seed;   /* Main lane */
+  sb_u64 see1;   /* Second lane of the 48 byte block loop */
+  sb_u64 see2;   /* Third lane of the 48 byte block loop */
+  sb_size processed; /* Bytes consumed by the block loop */
+
+} sb_hash_state;
+
+SB_API SB_INLINE void sb_hash_init(sb_hash_state *st, sb_u64 seed)
+{
+  st->seed = seed ^ sb_mix(seed ^ SB_HASH_P0, SB_HASH_P1);
+  st->see1 = st->seed;
+  st->see2 = st->seed;
+  st->processed = 0;
+}
+
+/* Consumes the 48 byte blocks of p[0..n). The last 1..48 bytes are always left for the finalizer. */
+SB_API SB_INLINE void sb_hash_blocks(sb_hash_state *st, unsigned char *p, sb_size n)
+{
+  sb_size i = st->processed;
+
+  while (n - i > 48)
+  {
+    st->seed = sb_mix(sb_read64le(p + i) ^ SB_HASH_P1, sb_read64le(p + i + 8) ^ st->seed);
+    st->see1 = sb_mix(sb_read64le(p + i + 16) ^ SB_HASH_P2, sb_read64le(p + i + 24) ^ st->see1);
+    st->see2 = sb_mix(sb_read64le(p + i + 32) ^ SB_HASH_P3, sb_read64le(p + i + 40) ^ st->see2);
+    i += 48;
+  }
+
+  st->processed = i;
+}
+
+SB_API SB_INLINE sb_u64 sb_hash_finish(sb_hash_state *st, unsigned char *p, sb_size n)
+{
+  sb_u64 seed = st->seed;
+  sb_u64 a;
+  sb_u64 b;
+
+  if (n <= 16)
+  {
+    if (n >= 4)
+    {
+      int k = (int)((n >> 3) << 2);
+      a = (sb_read32le(p) << 32) | sb_read32le(p + k);
+      b = (sb_read32le(p + n - 4) << 32) | sb_read32le(p + n - 4 - k);
+    }
+    else if (n > 0)
+    {
+      a = ((sb_u64)p[0] << 16) | ((sb_u64)p[n >> 1] << 8) | (sb_u64)p[n - 1];
+      b = 0;
+    }
+    else
+    {
+      a = 0;
+      b = 0;
+    }
+  }
+  else
+  {
+    sb_size i;
+
+    sb_hash_blocks(st, p, n);
+
+    if (st->processed > 0)
+    {
+      seed = st->seed ^ st->see1 ^ st->see2;
+    }
+
+    for (i = st->processed; n - i > 16; i += 16)
+    {
+      seed = sb_mix(sb_read64le(p + i) ^ SB_HASH_P1, sb_read64le(p + i + 8) ^ seed);
+    }
+
+    a = sb_read64le(p + n - 16);
+    b = sb_read64le(p + n - 8);
+  }
+
+  a ^= SB_HASH_P1;
+  b ^= seed;
+  sb_mum(&a, &b);
+
+  return sb_mix(a ^ SB_HASH_P0 ^ (sb_u64)n, b ^ SB_HASH_P1);
+}
+
+/* 64-bit non-cryptographic hash (wyhash construction) of n bytes */
+SB_API SB_INLINE sb_u64 sb_hash64_bytes(char *s, sb_size n, sb_u64 seed)
+{
+  sb_hash_state st;
+  sb_hash_init(&st, seed);
+  return sb_hash_finish(&st, (unsigned char *)s, n);
+}
+
+/* Length of the content that is actually stored in the builder */
+SB_API SB_INLINE sb_size sb_stored_len(sb *sb)
+{
+  return (sb->len < sb->cap) ? sb->len : sb->cap;
+}
+
+SB_API SB_INLINE sb_u64 sb_hash64(sb *sb)
+{
+  return sb_hash64_bytes(sb->buf, sb_stored_len(sb), 0);
+}
+
+/* Incremental mode: call sb_hash_update after appending to hash the new complete blocks while they are
+ * still hot in cache, sb_hash_final then only processes the last <= 48 bytes.
+ */
+SB_API SB_INLINE void sb_hash_update(sb_hash_state *st, sb *sb)
+{
+  sb_hash_blocks(st, (unsigned char *)sb->buf, sb_stored_len(sb));
+}
+
+SB_API SB_INLINE sb_u64 sb_hash_final(sb_hash_state *st, sb *sb)
+{
+  return sb_hash_finish(st, (unsigned char *)sb->buf, sb_stored_len(sb));
+}
+
+/* #############################################################################
+ * # CRC32C
+ * #############################################################################
+ */
+/* Slice-by-8 tables for the Castagnoli polynomial (reflected 0x82F63B78), built once on first use */
+static unsigned int SB_CRC32C_TABLE[8][256];
+static int SB_CRC32C_TABLE_ONCE = 0;
+
+SB_API SB_INLINE void sb_crc32c_init_table(void)
+{
+  unsigned int i;
+  int k;
+
+  for (i = 0; i < 256; ++i)
+  {
+    unsigned int c = i;
+
+    for (k = 0; k < 8; ++k)
+    {
+      c = (c & 1u) ? (c >> 1) ^ 0x82f63b78u : (c >> 1);
+    }
+
+    SB_CRC32C_TABLE[0][i] = c;
+  }
+
+  for (i = 0; i < 256; ++i)
+  {
+    for (k = 1; k < 8; ++k)
+    {
+      unsigned int prev = SB_CRC32C_TABLE[k - 1][i];
+      SB_CRC32C_TABLE[k][i] = (prev >> 8) ^ SB_CRC32C_TABLE[0][prev & 0xffu];
+    }
+  }
+
+  sb_once_done(&SB_CRC32C_TABLE_ONCE);
+}
+
+#ifdef SB_KERNEL_SSE42
+SB_API SB_INLINE SB_TARGET("sse4.2") unsigned int sb_crc32c_sse42(unsigned int crc, unsigned char *p, sb_size n)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+  sb_u64 c = crc;
+
+  for (; n >= 8; n -= 8, p += 8)
+  {
+    c = _mm_crc32_u64(c, sb_read64le(p));
+  }
+
+  crc = (unsigned int)c;
+#endif
+
+  for (; n >= 4; n -= 4, p += 4)
+  {
+    crc = _mm_crc32_u32(crc, (unsigned int)sb_read32le(p));
+  }
+
+  for (; n > 0; --n)
+  {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+
+  return crc;
+}
+#endif
+
+#ifdef SB_KERNEL_ARM_CRC32
+#ifdef SB_DISPATCH_ARM
+SB_API SB_INLINE SB_TARGET("+crc") unsigned int sb_crc32c_armv8(unsigned int crc, unsigned char *p, sb_size n)
+#else
+SB_API SB_INLINE unsigned int sb_crc32c_armv8(unsigned int crc, unsigned char *p, sb_size n)
+#endif
+{
+  for (; n >= 8; n -= 8, p += 8)
+  {
+#ifdef SB_DISPATCH_ARM
+    crc = __builtin_aarch64_crc32cx(crc, sb_read64le(p));
+#else
+    crc = __crc32cd(crc, sb_read64le(p));
+#endif
+  }
+
+  for (; n > 0; --n)
+  {
+#ifdef SB_DISPATCH_ARM
+    crc = __builtin_aarch64_crc32cb(crc, *p++);
+#else
+    crc = __crc32cb(crc, *p++);
+#endif
+  }
+
+  return crc;
+}
+#endif
+
+/* CRC32C of n bytes continuing from crc (pass 0 to start, the previous result to chain).
+ * Uses the SSE4.2 or ARMv8 crc32 instructions when the CPU has them, slice-by-8 otherwise.
+ */
+SB_API SB_INLINE unsigned int sb_crc32c_bytes(unsigned int crc, char *s, sb_size n)
+{
+  unsigned char *p = (unsigned char *)s;
+
+  crc = ~crc;
+
+  if (sb_cpu_kernels()->crc32c)
+  {
+    return ~sb_cpu_kernels()->crc32c(crc, p, n);
+  }
+
+  if (sb_once(&SB_CRC32C_TABLE_ONCE))
+  {
+    sb_crc32c_init_table();
+  }
+
+  for (; n >= 8; n -= 8, p += 8)
+  {
+    unsigned int lo = crc ^ (unsigned int)sb_read32le(p);
+    unsigned int hi = (unsigned int)sb_read32le(p + 4);
+
+    crc = SB_CRC32C_TABLE[7][lo & 0xffu] ^ SB_CRC32C_TABLE[6][(lo >> 8) & 0xffu] ^
+          SB_CRC32C_TABLE[5][(lo >> 16) & 0xffu] ^ SB_CRC32C_TABLE[4][lo >> 24] ^
+          SB_CRC32C_TABLE[3][hi & 0xffu] ^ SB_CRC32C_TABLE[2][(hi >> 8) & 0xffu] ^
+          SB_CRC32C_TABLE[1][(hi >> 16) & 0xffu] ^ SB_CRC32C_TABLE[0][hi >> 24];
+  }
+
+  for (; n > 0; --n)
+  {
+    crc = SB_CRC32C_TABLE[0][(crc ^ *p++) & 0xffu] ^ (crc >> 8);
+  }
+
+  return ~crc;
+}
+
+/* CRC32C of the stored builder content in [start, end) */
+SB_API SB_INLINE unsigned int sb_crc32c(sb *sb, sb_size start, sb_size end)
+{
+  sb_size stored = sb_stored_len(sb);
+
+  if (end > stored)
+  {
+    end = stored;
+  }
+
+  if (start < 0 || start >= end)
+  {
+    return 0;
+  }
+
+  return sb_crc32c_bytes(0, sb->buf + start, end - start);
+}
+
+/* Appends the CRC32C of [start, len) as 4 little endian bytes (record framing) */
+SB_API SB_INLINE unsigned int sb_append_crc32c(sb *sb, sb_size start)
+{
+  unsigned int crc = sb_crc32c(sb, start, sb->len);
+  char le[4];
+
+  le[0] = (char)(crc & 0xffu);
+  le[1] = (char)((crc >> 8) & 0xffu);
+  le[2] = (char)((crc >> 16) & 0xffu);
+  le[3] = (char)(crc >> 24);
+  sb_append_bytes(sb, le, 4);
+
+  return crc;
+}
+
+/* Selects the kernels for a SB_CPU_* set. Runs on first use with sb_cpu_features(). Calling it once at
+ * startup avoids the lazy selection, a reduced set forces slower kernels (e.g. 0 for the scalar paths).
+ * Explicit calls have to happen before other threads use sb, the table is published once.
+ */
+SB_API SB_INLINE void sb_cpu_dispatch(unsigned int features)
+{
+  sb_kernels *k = &SB_KERNELS;
+
+  k->features = features;
+  k->base64_encode = 0;
+  k->base64_decode = 0;
+  k->utf8_validate = 0;
+  k->crc32c = 0;
+
+#ifdef SB_KERNEL_SSSE3
+  if (features & SB_CPU_SSSE3)
+  {
+    k->base64_encode = sb_base64_encode_ssse3;
+    k->base64_decode = sb_base64_decode_ssse3;
+    k->utf8_validate = sb_utf8_validate_ssse3;
+  }
+#endif
+
+#ifdef SB_KERNEL_SSE42
+  if (features & SB_CPU_SSE42)
+  {
+    k->crc32c = sb_crc32c_sse42;
+  }
+#endif
+
+#ifdef SB_KERNEL_ARM_CRC32
+  if (features & SB_CPU_ARM_CRC32)
+  {
+    k->crc32c = sb_crc32c_armv8;
+  }
+#endif
+
+  sb_once_done(&SB_KERNELS_ONCE);
+}
+
+/* #############################################################################
+ * # BACKPATCHING
+ * #############################################################################
+ */
+/* Placeholder bytes reserved in a builder, filled once the following payload is known */
+typedef struct sb_slot
+{
+  sb_size pos; /* Offset of the placeholder */
+  int width;   /* Number of reserved bytes  */
+
+} sb_slot;
+
+/* Reserves width zero bytes at the current position and returns their handle */
+SB_API SB_INLINE sb_slot sb_reserve_slot(sb *sb, int width)
+{
+  sb_slot slot;
+  int i;
+
+  if (width < 0)
+  {
+    width = 0;
+  }
+
+  slot.pos = sb->len;
+  slot.width = width;
+
+  for (i = 0; i < width; ++i)
+  {
+    sb_putc(sb, '\0');
+  }
+
+  return slot;
+}
+
+/* Number of bytes appended after the slot (the payload length of a [len][payload] frame) */
+SB_API SB_INLINE sb_size sb_slot_len(sb *sb, sb_slot slot)
+{
+  return sb->len - (slot.pos + slot.width);
+}
+
+/* Slot placeholder if it is fully stored, 0 when it fell past the capacity */
+SB_API SB_INLINE char *sb_slot_ptr(sb *sb, sb_slot slot)
+{
+  if (slot.pos < 0 || slot.pos + slot.width > sb->cap)
+  {
+    return (char *)0;
+  }
+
+  return sb->buf + slot.pos;
+}
+
+/* Writes v as 4 little endian bytes at the start of the slot. Returns 0 if the slot is too small or not stored. */
+SB_API SB_INLINE int sb_patch_u32le(sb *sb, sb_slot slot, unsigned long v)
+{
+  char *p = sb_slot_ptr(sb, slot);
+
+  if (!p || slot.width < 4)
+  {
+    return 0;
+  }
+
+  p[0] = (char)(v & 0xfful);
+  p[1] = (char)((v >> 8) & 0xfful);
+  p[2] = (char)((v >> 16) & 0xfful);
+  p[3] = (char)((v >> 24) & 0xfful);
+
+  return 1;
+}
+
+/* Writes v as a LEB128 varint padded with continuation bytes to exactly the slot width
+ * (the non-minimal encoding is accepted by LEB128 / protobuf decoders). Returns 0 if v does not fit.
+ */
+SB_API SB_INLINE int sb_patch_varint(sb *sb, sb_slot slot, sb_u64 v)
+{
+  char *p = sb_slot_ptr(sb, slot);
+  int i;
+
+  if (!p || slot.width < 1 || slot.width > 10 || (slot.width < 10 && (v >> (7 * slot.width)) != 0))
+  {
+    return 0;
+  }
+
+  for (i = 0; i < slot.width - 1; ++i)
+  {
+    p[i] = (char)((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+
+  p[i] = (char)(v & 0x7f);
+
+  return 1;
+}
+
+/* Writes v right aligned in base 10 or 16 over the full slot width, left filled with pad.
+ * Nothing is written if v needs more digits than the slot holds.
+ */
+SB_API SB_INLINE int sb_patch_digits(sb *sb, sb_slot slot, unsigned long v, unsigned long base, char pad)
+{
+  char *p = sb_slot_ptr(sb, slot);
+  unsigned long t = v;
+  int digits = 0;
+  int i;
+
+  if (!p || slot.width < 1)
+  {
+    return 0;
+  }
+
+  do
+  {
+    t /= base;
+    digits++;
+  } while (t != 0);
+
+  if (digits > slot.width)
+  {
+    return 0;
+  }
+
+  i = slot.width;
+
+  do
+  {
+    p[--i] = "0123456789abcdef"[v % base];
+    v /= base;
+  } while (v != 0);
+
+  while (i > 0)
+  {
+    p[--i] = pad;
+  }
+
+  return 1;
+}
+
+/* Fixed width decimal for text framing, e.g. a space padded "Content-Length:    42" header */
+SB_API SB_INLINE int sb_patch_decimal(sb *sb, sb_slot slot, unsigned long v, char pad)
+{
+  return sb_patch_digits(sb, slot, v, 10ul, pad);
+}
+
+/* Fixed width hexadecimal, e.g. HTTP chunk sizes ("000a\r\n") */
+SB_API SB_INLINE int sb_patch_hex(sb *sb, sb_slot slot, unsigned long v, char pad)
+{
+  return sb_patch_digits(sb, slot, v, 16ul, pad);
+}
+
+/* #############################################################################
+ * # BINARY ENCODING
+ * #############################################################################
+ */
+typedef union sb_f64_bits
+{
+  double d;
+  sb_u64 u;
+
+} sb_f64_bits;
+
+/* Stores the n low bytes of v in little / big endian order */
+SB_API SB_INLINE void sb_store_le(char *p, sb_u64 v, int n)
+{
+  int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    p[i] = (char)(v & 0xffu);
+    v >>= 8;
+  }
+}
+
+SB_API SB_INLINE void sb_store_be(char *p, sb_u64 v, int n)
+{
+  int i;
+
+  for (i = n - 1; i >= 0; --i)
+  {
+    p[i] = (char)(v & 0xffu);
+    v >>= 8;
+  }
+}
+
+SB_API SB_INLINE sb_u64 sb_load_le(char *p, int n)
+{
+  sb_u64 v = 0;
+  int i;
+
+  for (i = n - 1; i >= 0; --i)
+  {
+    v = (v << 8) | (unsigned char)p[i];
+  }
+
+  return v;
+}
+
+SB_API SB_INLINE sb_u64 sb_load_be(char *p, int n)
+{
+  sb_u64 v = 0;
+  int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    v = (v << 8) | (unsigned char)p[i];
+  }
+
+  return v;
+}
+
+SB_API SB_INLINE void sb_append_fixed(sb *sb, sb_u64 v, int n, int big_endian)
+{
+  char tmp[8];
+  char *p = (sb->cap - sb->len >= n) ? sb->buf + sb->len : tmp;
+
+  if (big_endian)
+  {
+    sb_store_be(p, v, n);
+  }
+  else
+  {
+    sb_store_le(p, v, n);
+  }
+
+  if (p == tmp)
+  {
+    sb_append_bytes(sb, tmp, n);
+  }
+  else
+  {
+    sb->len += n;
+  }
+}
+
+SB_API SB_INLINE void sb_append_u16le(sb *sb, unsigned int v)
+{
+  sb_append_fixed(sb, v, 2, 0);
+}
+
+SB_API SB_INLINE void sb_append_u32le(sb *sb, unsigned int v)
+{
+  sb_append_fixed(sb, v, 4, 0);
+}
+
+SB_API SB_INLINE void sb_append_u64le(sb *sb, sb_u64 v)
+{
+  sb_append_fixed(sb, v, 8, 0);
+}
+
+SB_API SB_INLINE void sb_append_u16be(sb *sb, unsigned int v)
+{
+  sb_append_fixed(sb, v, 2, 1);
+}
+
+SB_API SB_INLINE void sb_append_u32be(sb *sb, unsigned int v)
+{
+  sb_append_fixed(sb, v, 4, 1);
+}
+
+SB_API SB_INLINE void sb_append_u64be(sb *sb, sb_u64 v)
+{
+  sb_append_fixed(sb, v, 8, 1);
+}
+
+/* IEEE 754 bit pattern of x */
+SB_API SB_INLINE void sb_append_f64le(sb *sb, double x)
+{
+  sb_f64_bits b;
+  b.d = x;
+  sb_append_fixed(sb, b.u, 8, 0);
+}
+
+SB_API SB_INLINE void sb_append_f64be(sb *sb, double x)
+{
+  sb_f64_bits b;
+  b.d = x;
+  sb_append_fixed(sb, b.u, 8, 1);
+}
+
+SB_API SB_INLINE unsigned int sb_load_u16le(char *p)
+{
+  return (unsigned int)sb_load_le(p, 2);
+}
+
+SB_API SB_INLINE unsigned int sb_load_u32le(char *p)
+{
+  return (unsigned int)sb_load_le(p, 4);
+}
+
+SB_API SB_INLINE sb_u64 sb_load_u64le(char *p)
+{
+  return sb_load_le(p, 8);
+}
+
+SB_API SB_INLINE unsigned int sb_load_u16be(char *p)
+{
+  return (unsigned int)sb_load_be(p, 2);
+}
+
+SB_API SB_INLINE unsigned int sb_load_u32be(char *p)
+{
+  return (unsigned int)sb_load_be(p, 4);
+}
+
+SB_API SB_INLINE sb_u64 sb_load_u64be(char *p)
+{
+  return sb_load_be(p, 8);
+}
+
+SB_API SB_INLINE double sb_load_f64le(char *p)
+{
+  sb_f64_bits b;
+  b.u = sb_load_le(p, 8);
+  return b.d;
+}
+
+SB_API SB_INLINE double sb_load_f64be(char *p)
+{
+  sb_f64_bits b;
+  b.u = sb_load_be(p, 8);
+  return b.d;
+}
+
+/* Encoded LEB128 length (1..10) without a loop: ceil(bits / 7) with bits >= 1 */
+SB_API SB_INLINE int sb_varint_len(sb_u64 v)
+{
+  return (sb_bit_length_u64(v | 1u) * 9 + 64) >> 6;
+}
+
+/* Writes the varint of v to dst (at least 10 bytes) and returns its length */
+SB_API SB_INLINE int sb_varint_encode(char *dst, sb_u64 v)
+{
+  int n = sb_varint_len(v);
+  int i;
+
+  for (i = 0; i < n - 1; ++i)
+  {
+    dst[i] = (char)((v & 0x7fu) | 0x80u);
+    v >>= 7;
+  }
+
+  dst[n - 1] = (char)v;
+
+  return n;
+}
+
+SB_API SB_INLINE sb_u64 sb_zigzag_encode64(sb_i64 v)
+{
+  sb_u64 u = (sb_u64)v;
+  return (u << 1) ^ (0 - (u >> 63));
+}
+
+SB_API SB_INLINE sb_i64 sb_zigzag_decode64(sb_u64 u)
+{
+  return (sb_i64)((u >> 1) ^ (0 - (u & 1u)));
+}
+
+SB_API SB_INLINE int sb_append_varint_u64(sb *sb, sb_u64 v)
+{
+  char tmp[10];
+  int n;
+
+  if (sb->cap - sb->len >= 10)
+  {
+    n = sb_varint_encode(sb->buf + sb->len, v);
+    sb->len += n;
+    return n;
+  }
+
+  n = sb_varint_encode(tmp, v);
+  sb_append_bytes(sb, tmp, n);
+
+  return n;
+}
+
+/* Signed varint (protobuf sint64) */
+SB_API SB_INLINE int sb_append_zigzag_i64(sb *sb, sb_i64 v)
+{
+  return sb_append_varint_u64(sb, sb_zigzag_encode64(v));
+}
+
+/* Decodes a varint from src[0..n). Returns the bytes consumed, 0 when truncated or longer than 10 bytes. */
+SB_API SB_INLINE int sb_varint_decode_u64(char *src, int n, sb_u64 *out)
+{
+  sb_u64 v = 0;
+  int i;
+
+  for (i = 0; i < n && i < 10; ++i)
+  {
+    unsigned char b = (unsigned char)src[i];
+
+    v |= (sb_u64)(b & 0x7fu) << (7 * i);
+
+    if (!(b & 0x80u))
+    {
+      *out = v;
+      return i + 1;
+    }
+  }
+
+  return 0;
+}
+
+SB_API SB_INLINE int sb_varint_decode_i64(char *src, int n, sb_i64 *out)
+{
+  sb_u64 u;
+  int r = sb_varint_decode_u64(src, n, &u);
+
+  if (r)
+  {
+    *out = sb_zigzag_decode64(u);
+  }
+
+  return r;
+}
+
+SB_API SB_INLINE int sb_cmp(sb *sb, char *s)
+{
+  sb_size i;
+
+  for (i = 0; i < sb->len && s[i] != '\0'; ++i)
+  {
+    unsigned char c1 = (unsigned char)sb->buf[i];
+    unsigned char c2 = (unsigned char)s[i];
+
+    if (c1 != c2)
+    {
+      return c1 - c2;
+    }
+  }
+
+  if (i < sb->len)
+  {
+    return (unsigned char)sb->buf[i];
+  }
+
+  if (s[i] != '\0')
+  {
+    return -(unsigned char)s[i];
+  }
+
+  return 0;
+}
+
+SB_API SB_INLINE int sb_ncmp(sb *sb, char *s, int n)
+{
+  sb_size i;
+
+  for (i = 0; i < n && i < sb->len && s[i] != '\0'; ++i)
+  {
+    unsigned char c1 = (unsigned char)sb->buf[i];
+    unsigned char c2 = (unsigned char)s[i];
+
+    if (c1 != c2)
+    {
+      return c1 - c2;
+    }
+  }
+
+  if (i == n)
+  {
+    return 0;
+  }
+
+  if (i < sb->len)
+  {
+    return (unsigned char)sb->buf[i];
+  }
+
+  if (s[i] != '\0')
+  {
+    return -(unsigned char)s[i];
+  }
+
+  return 0;
+}
+
+/* #############################################################################
+ * # PRINTF like implementation
+ * #############################################################################
+ */
+SB_API SB_INLINE void sb_printf(sb *s, char *fmt, void **args, int argc)
+{
+  int arg_idx = 0;
+  char *p = fmt;
+
+  if (argc <= 0)
+  {
+    return;
+  }
+
+  while (*p)
+  {
+    if (*p == '%' && *(p + 1))
+    {
+      int width = 0;
+      int precision = -1;
+      sb_pad_mode pad = SB_PAD_NONE;
+
+      ++p; /* skip '%' */
+
+      /* check left-pad flag */
+      if (*p == '-')
+      {
+        pad = SB_PAD_LEFT;
+        ++p;
+      }
+
+      /* parse width */
+      while (*p >= '0' && *p <= '9')
+      {
+        width = width * 10 + (*p - '0');
+        ++p;
+      }
+
+      if (width > 0 && pad == SB_PAD_NONE)
+      {
+        pad = SB_PAD_RIGHT;
+      }
+
+      /* parse precision */
+      if (*p == '.')
+      {
+        ++p;
+        precision = 0;
+
+        while (*p >= '0' && *p <= '9')
+        {
+          precision = precision * 10 + (*p - '0');
+          ++p;
+        }
+      }
+
+      switch (*p)
+      {
+      case 's':
+        sb_append_cstr_padded(s, (char *)args[arg_idx], width, pad);
+        break;
+      case 'S':
+        sb_append_cstr_padded_width(s, (char *)args[arg_idx], width, pad, SB_WIDTH_COLUMNS);
+        break;
+      case 'd':
+        sb_append_long(s, *((long *)args[arg_idx]), width, pad);
+        break;
+      case 'u':
+        sb_append_ulong(s, *((unsigned long *)args[arg_idx]), width, pad);
+        break;
       case 'f':
         sb_append_double(s, *((double *)args[arg_idx]), width, (precision < 0 ? 6 : precision), pad);
         break;
+      case 'x':
+        sb_append_hex(s, *((unsigned long *)args[arg_idx]), width, pad, SB_CASE_LOWER);
+        break;
+      case 'X':
+        sb_append_hex(s, *((unsigned long *)args[arg_idx]), width, pad, SB_CASE_UPPER);
+        break;
+      case 'o':
+        sb_append_oct(s, *((unsigned long *)args[arg_idx]), width, pad);
+        break;
       case 'c':
         sb_putc(s, *((char *)args[arg_idx]));
         break;
@@ -609,100 +3250,3143 @@ SB_API SB_INLINE void sb_printf(sb *s, char *fmt, void **args, int argc)
         break;
       }
 
-      arg_idx++;
+      arg_idx++;
+    }
+    else
+    {
+      sb_putc(s, *p);
+    }
+
+    p++;
+  }
+}
+
+SB_API SB_INLINE void sb_printf1(sb *s, char *fmt, char *a1)
+{
+  void *args[1];
+  args[0] = a1;
+  sb_printf(s, fmt, args, 1);
+}
+
+SB_API SB_INLINE void sb_printf2(sb *s, char *fmt, char *a1, char *a2)
+{
+  void *args[2];
+  args[0] = a1;
+  args[1] = a2;
+  sb_printf(s, fmt, args, 2);
+}
+
+SB_API SB_INLINE void sb_printf3(sb *s, char *fmt, char *a1, char *a2, char *a3)
+{
+  void *args[3];
+  args[0] = a1;
+  args[1] = a2;
+  args[2] = a3;
+  sb_printf(s, fmt, args, 3);
+}
+
+SB_API SB_INLINE void sb_printf4(sb *s, char *fmt, char *a1, char *a2, char *a3, char *a4)
+{
+  void *args[4];
+  args[0] = a1;
+  args[1] = a2;
+  args[2] = a3;
+  args[3] = a4;
+  sb_printf(s, fmt, args, 4);
+}
+
+SB_API SB_INLINE void sb_printf5(sb *s, char *fmt, char *a1, char *a2, char *a3, char *a4, char *a5)
+{
+  void *args[5];
+  args[0] = a1;
+  args[1] = a2;
+  args[2] = a3;
+  args[3] = a4;
+  args[4] = a5;
+  sb_printf(s, fmt, args, 5);
+}
+
+SB_API SB_INLINE void sb_printf6(sb *s, char *fmt, char *a1, char *a2, char *a3, char *a4, char *a5, char *a6)
+{
+  void *args[6];
+  args[0] = a1;
+  args[1] = a2;
+  args[2] = a3;
+  args[3] = a4;
+  args[4] = a5;
+  args[5] = a6;
+  sb_printf(s, fmt, args, 6);
+}
+
+SB_API SB_INLINE void sb_printf7(sb *s, char *fmt, char *a1, char *a2, char *a3, char *a4, char *a5, char *a6, char *a7)
+{
+  void *args[7];
+  args[0] = a1;
+  args[1] = a2;
+  args[2] = a3;
+  args[3] = a4;
+  args[4] = a5;
+  args[5] = a6;
+  args[6] = a7;
+  sb_printf(s, fmt, args, 7);
+}
+
+SB_API SB_INLINE void sb_printf8(sb *s, char *fmt, char *a1, char *a2, char *a3, char *a4, char *a5, char *a6, char *a7, char *a8)
+{
+  void *args[8];
+  args[0] = a1;
+  args[1] = a2;
+  args[2] = a3;
+  args[3] = a4;
+  args[4] = a5;
+  args[5] = a6;
+  args[6] = a7;
+  args[7] = a8;
+  sb_printf(s, fmt, args, 8);
+}
+
+/* #############################################################################
+ * # JSON writer
+ * #############################################################################
+ */
+#ifndef SB_JSON_MAX_DEPTH
+#define SB_JSON_MAX_DEPTH 32
+#endif
+
+#define SB_JSON_OBJECT 1 /* Container is an object (otherwise an array) */
+#define SB_JSON_ITEMS 2  /* Container already has at least one member */
+
+typedef struct sb_json
+{
+  sb *sb;                                  /* Output string builder */
+  int depth;                               /* Current nesting depth */
+  int key;                                 /* 1 if a key was written and its value is pending */
+  int err;                                 /* Error flag (1 on nesting misuse) */
+  unsigned char stack[SB_JSON_MAX_DEPTH]; /* SB_JSON_* flags per nesting level */
+
+} sb_json;
+
+/* Writes one escape sequence for byte b to p and returns its length */
+SB_API SB_INLINE int sb_json_escape_byte(char *p, unsigned char b)
+{
+  char e = SB_LUT_JSON_ESCAPE[b];
+
+  p[0] = '\\';
+
+  if (e != 'u')
+  {
+    p[1] = e;
+    return 2;
+  }
+
+  p[1] = 'u';
+  p[2] = '0';
+  p[3] = '0';
+  p[4] = SB_LUT_HEX_LOWER[0][(b >> 4) * 2u + 1u];
+  p[5] = SB_LUT_HEX_LOWER[0][(b & 15u) * 2u + 1u];
+  return 6;
+}
+
+/* Appends n bytes of s with JSON string escaping applied (without the surrounding quotes) */
+SB_API SB_INLINE void sb_append_json_escaped(sb *sb, char *s, int n)
+{
+  unsigned char *u = (unsigned char *)s;
+  int i = 0;
+
+  if (n <= 0)
+  {
+    return;
+  }
+
+  /* Fast path: worst case (6 bytes per input byte) fits, write straight into the buffer */
+  if ((sb->cap - sb->len) / 6 > n)
+  {
+    char *dst = sb->buf + sb->len;
+
+#ifdef SB_SIMD_SSE2
+    __m128i quote = _mm_set1_epi8('"');
+    __m128i bslash = _mm_set1_epi8('\\');
+    __m128i ctrl = _mm_set1_epi8(0x1f);
+
+    SB_LAUNDER(u);
+
+    while (i + 16 <= n)
+    {
+      __m128i x = _mm_loadu_si128((__m128i *)(void *)(u + i));
+      __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, bslash));
+      unsigned int mask;
+
+      /* Unsigned x <= 0x1f */
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(x, ctrl), ctrl));
+      mask = (unsigned int)_mm_movemask_epi8(m);
+
+      /* Store the whole block, only the clean prefix is kept */
+      _mm_storeu_si128((__m128i *)(void *)dst, x);
+
+      if (mask == 0)
+      {
+        dst += 16;
+        i += 16;
+        continue;
+      }
+
+      mask = (unsigned int)sb_ctz32(mask);
+      dst += mask;
+      i += (int)mask;
+      dst += sb_json_escape_byte(dst, u[i]);
+      i++;
+    }
+#endif
+
+    for (; i < n; ++i)
+    {
+      if (SB_LUT_JSON_ESCAPE[u[i]])
+      {
+        dst += sb_json_escape_byte(dst, u[i]);
+      }
+      else
+      {
+        *dst++ = (char)u[i];
+      }
+    }
+
+    sb->len = (sb_size)(dst - sb->buf);
+    return;
+  }
+
+  /* Near capacity: copy clean runs with sb_append_bytes and escape the rest */
+  while (i < n)
+  {
+    int start = i;
+
+    while (i < n && !SB_LUT_JSON_ESCAPE[u[i]])
+    {
+      i++;
+    }
+
+    sb_append_bytes(sb, s + start, i - start);
+
+    if (i < n)
+    {
+      char esc[6];
+      sb_append_bytes(sb, esc, sb_json_escape_byte(esc, u[i]));
+      i++;
+    }
+  }
+}
+
+SB_API SB_INLINE void sb_json_init(sb_json *j, sb *sb)
+{
+  j->sb = sb;
+  j->depth = 0;
+  j->key = 0;
+  j->err = 0;
+}
+
+/* Emits the comma between members and marks the container as non-empty */
+SB_API SB_INLINE void sb_json_comma(sb_json *j)
+{
+  unsigned char *top = &j->stack[j->depth - 1];
+
+  if (*top & SB_JSON_ITEMS)
+  {
+    sb_putc(j->sb, ',');
+  }
+
+  *top |= SB_JSON_ITEMS;
+}
+
+/* Emits the separator before a value. Inside an object a value needs a key first. */
+SB_API SB_INLINE void sb_json_sep(sb_json *j)
+{
+  if (j->key)
+  {
+    j->key = 0;
+    return;
+  }
+
+  if (j->depth == 0)
+  {
+    return;
+  }
+
+  if (j->stack[j->depth - 1] & SB_JSON_OBJECT)
+  {
+    j->err = 1;
+  }
+
+  sb_json_comma(j);
+}
+
+SB_API SB_INLINE void sb_json_begin(sb_json *j, unsigned char type, char c)
+{
+  sb_json_sep(j);
+
+  if (j->depth >= SB_JSON_MAX_DEPTH)
+  {
+    j->err = 1;
+    return;
+  }
+
+  j->stack[j->depth++] = type;
+  sb_putc(j->sb, c);
+}
+
+SB_API SB_INLINE void sb_json_end(sb_json *j, unsigned char type, char c)
+{
+  if (j->depth == 0 || (j->stack[j->depth - 1] & SB_JSON_OBJECT) != type || j->key)
+  {
+    j->err = 1;
+    return;
+  }
+
+  j->depth--;
+  sb_putc(j->sb, c);
+}
+
+SB_API SB_INLINE void sb_json_object_begin(sb_json *j)
+{
+  sb_json_begin(j, SB_JSON_OBJECT, '{');
+}
+
+SB_API SB_INLINE void sb_json_object_end(sb_json *j)
+{
+  sb_json_end(j, SB_JSON_OBJECT, '}');
+}
+
+SB_API SB_INLINE void sb_json_array_begin(sb_json *j)
+{
+  sb_json_begin(j, 0, '[');
+}
+
+SB_API SB_INLINE void sb_json_array_end(sb_json *j)
+{
+  sb_json_end(j, 0, ']');
+}
+
+SB_API SB_INLINE void sb_json_key_n(sb_json *j, char *key, int n)
+{
+  if (j->depth == 0 || !(j->stack[j->depth - 1] & SB_JSON_OBJECT) || j->key)
+  {
+    j->err = 1;
+    return;
+  }
+
+  sb_json_comma(j);
+  sb_putc(j->sb, '"');
+  sb_append_json_escaped(j->sb, key, n);
+  sb_putc(j->sb, '"');
+  sb_putc(j->sb, ':');
+  j->key = 1;
+}
+
+SB_API SB_INLINE void sb_json_key(sb_json *j, char *key)
+{
+  int n = 0;
+
+  while (key[n] != '\0')
+  {
+    n++;
+  }
+
+  sb_json_key_n(j, key, n);
+}
+
+SB_API SB_INLINE void sb_json_string_n(sb_json *j, char *s, int n)
+{
+  sb_json_sep(j);
+  sb_putc(j->sb, '"');
+  sb_append_json_escaped(j->sb, s, n);
+  sb_putc(j->sb, '"');
+}
+
+SB_API SB_INLINE void sb_json_string(sb_json *j, char *s)
+{
+  int n = 0;
+
+  while (s[n] != '\0')
+  {
+    n++;
+  }
+
+  sb_json_string_n(j, s, n);
+}
+
+SB_API SB_INLINE void sb_json_long(sb_json *j, long v)
+{
+  sb_json_sep(j);
+  sb_append_long(j->sb, v, 0, SB_PAD_NONE);
+}
+
+SB_API SB_INLINE void sb_json_ulong(sb_json *j, unsigned long v)
+{
+  sb_json_sep(j);
+  sb_append_ulong(j->sb, v, 0, SB_PAD_NONE);
+}
+
+SB_API SB_INLINE void sb_json_double(sb_json *j, double v, int precision)
+{
+  sb_json_sep(j);
+
+  /* NaN and infinity have no JSON representation */
+  if (v != v || v - v != 0.0)
+  {
+    sb_append_bytes(j->sb, "null", 4);
+    return;
+  }
+
+  sb_append_double(j->sb, v, 0, precision, SB_PAD_NONE);
+}
+
+SB_API SB_INLINE void sb_json_bool(sb_json *j, int v)
+{
+  sb_json_sep(j);
+
+  if (v)
+  {
+    sb_append_bytes(j->sb, "true", 4);
+  }
+  else
+  {
+    sb_append_bytes(j->sb, "false", 5);
+  }
+}
+
+SB_API SB_INLINE void sb_json_null(sb_json *j)
+{
+  sb_json_sep(j);
+  sb_append_bytes(j->sb, "null", 4);
+}
+
+/* #############################################################################
+ * # CSV/TSV writer
+ * #############################################################################
+ */
+typedef struct sb_csv
+{
+  sb *sb;      /* Output string builder */
+  char *eol;   /* Record terminator, e.g. "\n" or "\r\n" */
+  int eol_len; /* Length of the record terminator */
+  int fields;  /* Number of fields written in the current record */
+  char delim;  /* Field delimiter, e.g. ',' or '\t' */
+
+} sb_csv;
+
+SB_API SB_INLINE void sb_csv_init(sb_csv *c, sb *sb, char delim, char *eol)
+{
+  c->sb = sb;
+  c->delim = delim;
+  c->eol = eol;
+  c->eol_len = 0;
+  c->fields = 0;
+
+  while (eol[c->eol_len] != '\0')
+  {
+    c->eol_len++;
+  }
+}
+
+/* Returns 1 if the field contains the delimiter, a quote, CR or LF and therefore must be quoted */
+SB_API SB_INLINE int sb_csv_needs_quote(char *s, int n, char delim)
+{
+  unsigned char *u = (unsigned char *)s;
+  int i = 0;
+
+#ifdef SB_SIMD_SSE2
+  __m128i vd = _mm_set1_epi8(delim);
+  __m128i vq = _mm_set1_epi8('"');
+  __m128i vn = _mm_set1_epi8('\n');
+  __m128i vr = _mm_set1_epi8('\r');
+
+  SB_LAUNDER(u);
+
+  for (; i + 16 <= n; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((__m128i *)(void *)(u + i));
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, vd), _mm_cmpeq_epi8(x, vq)),
+                             _mm_or_si128(_mm_cmpeq_epi8(x, vn), _mm_cmpeq_epi8(x, vr)));
+
+    if (_mm_movemask_epi8(m))
+    {
+      return 1;
+    }
+  }
+#endif
+
+  for (; i < n; ++i)
+  {
+    char ch = (char)u[i];
+
+    if (ch == delim || ch == '"' || ch == '\n' || ch == '\r')
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Appends s enclosed in quotes with embedded quotes doubled */
+SB_API SB_INLINE void sb_append_csv_quoted(sb *sb, char *s, int n)
+{
+  int i = 0;
+
+  sb_putc(sb, '"');
+
+  /* Fast path: worst case (every byte a quote) fits, write straight into the buffer */
+  if ((sb->cap - sb->len) / 2 > n + 8)
+  {
+    char *dst = sb->buf + sb->len;
+
+#ifdef SB_SIMD_SSE2
+    __m128i vq = _mm_set1_epi8('"');
+
+    SB_LAUNDER(s);
+
+    while (i + 16 <= n)
+    {
+      __m128i x = _mm_loadu_si128((__m128i *)(void *)(s + i));
+      unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x, vq));
+
+      _mm_storeu_si128((__m128i *)(void *)dst, x);
+
+      if (mask == 0)
+      {
+        dst += 16;
+        i += 16;
+        continue;
+      }
+
+      /* Keep the prefix including the quote, then emit the second quote */
+      mask = (unsigned int)sb_ctz32(mask) + 1u;
+      dst += mask;
+      i += (int)mask;
+      *dst++ = '"';
+    }
+#endif
+
+    for (; i < n; ++i)
+    {
+      *dst++ = s[i];
+
+      if (s[i] == '"')
+      {
+        *dst++ = '"';
+      }
+    }
+
+    sb->len = (sb_size)(dst - sb->buf);
+  }
+  else
+  {
+    while (i < n)
+    {
+      int start = i;
+
+      while (i < n && s[i] != '"')
+      {
+        i++;
+      }
+
+      if (i < n)
+      {
+        i++; /* include the quote, it gets doubled below */
+      }
+
+      sb_append_bytes(sb, s + start, i - start);
+
+      if (s[i - 1] == '"')
+      {
+        sb_putc(sb, '"');
+      }
+    }
+  }
+
+  sb_putc(sb, '"');
+}
+
+SB_API SB_INLINE void sb_csv_sep(sb_csv *c)
+{
+  if (c->fields++ > 0)
+  {
+    sb_putc(c->sb, c->delim);
+  }
+}
+
+SB_API SB_INLINE void sb_csv_field_n(sb_csv *c, char *s, int n)
+{
+  sb_csv_sep(c);
+
+  if (n > 0 && sb_csv_needs_quote(s, n, c->delim))
+  {
+    sb_append_csv_quoted(c->sb, s, n);
+  }
+  else
+  {
+    sb_append_bytes(c->sb, s, n);
+  }
+}
+
+SB_API SB_INLINE void sb_csv_field(sb_csv *c, char *s)
+{
+  int n = 0;
+
+  while (s[n] != '\0')
+  {
+    n++;
+  }
+
+  sb_csv_field_n(c, s, n);
+}
+
+SB_API SB_INLINE void sb_csv_long(sb_csv *c, long v)
+{
+  sb_csv_sep(c);
+  sb_append_long(c->sb, v, 0, SB_PAD_NONE);
+}
+
+SB_API SB_INLINE void sb_csv_ulong(sb_csv *c, unsigned long v)
+{
+  sb_csv_sep(c);
+  sb_append_ulong(c->sb, v, 0, SB_PAD_NONE);
+}
+
+SB_API SB_INLINE void sb_csv_double(sb_csv *c, double v, int precision)
+{
+  sb_csv_sep(c);
+  sb_append_double(c->sb, v, 0, precision, SB_PAD_NONE);
+}
+
+SB_API SB_INLINE void sb_csv_end_record(sb_csv *c)
+{
+  sb_append_bytes(c->sb, c->eol, c->eol_len);
+  c->fields = 0;
+}
+
+/* #############################################################################
+ * # HTML/XML and URL escaping
+ * #############################################################################
+ */
+/* Returns the index of the next byte at or after i that needs HTML/XML escaping, n if none */
+SB_API SB_INLINE int sb_markup_run(unsigned char *u, int i, int n)
+{
+#ifdef SB_SIMD_SSE2
+  __m128i amp = _mm_set1_epi8('&');
+  __m128i lt = _mm_set1_epi8('<');
+  __m128i gt = _mm_set1_epi8('>');
+  __m128i dq = _mm_set1_epi8('"');
+  __m128i sq = _mm_set1_epi8('\'');
+
+  SB_LAUNDER(u);
+
+  for (; i + 16 <= n; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((__m128i *)(void *)(u + i));
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, amp), _mm_cmpeq_epi8(x, lt)),
+                             _mm_or_si128(_mm_cmpeq_epi8(x, gt), _mm_or_si128(_mm_cmpeq_epi8(x, dq), _mm_cmpeq_epi8(x, sq))));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(m);
+
+    if (mask)
+    {
+      return i + sb_ctz32(mask);
+    }
+  }
+#endif
+
+  while (i < n && !(SB_LUT_ESCAPE[u[i]] & SB_ESCAPE_MARKUP))
+  {
+    i++;
+  }
+
+  return i;
+}
+
+SB_API SB_INLINE void sb_append_markup_escaped(sb *sb, char *s, int n, int xml)
+{
+  unsigned char *u = (unsigned char *)s;
+  int i = 0;
+
+  while (i < n)
+  {
+    int j = sb_markup_run(u, i, n);
+
+    sb_append_bytes(sb, s + i, j - i);
+
+    if (j == n)
+    {
+      break;
+    }
+
+    switch (u[j])
+    {
+    case '&':
+      sb_append_bytes(sb, "&amp;", 5);
+      break;
+    case '<':
+      sb_append_bytes(sb, "&lt;", 4);
+      break;
+    case '>':
+      sb_append_bytes(sb, "&gt;", 4);
+      break;
+    case '"':
+      sb_append_bytes(sb, "&quot;", 6);
+      break;
+    default: /* '\'' */
+      if (xml)
+      {
+        sb_append_bytes(sb, "&apos;", 6);
+      }
+      else
+      {
+        sb_append_bytes(sb, "&#39;", 5);
+      }
+      break;
+    }
+
+    i = j + 1;
+  }
+}
+
+/* Escapes & < > " ' for HTML text and attribute values ("'" becomes "&#39;") */
+SB_API SB_INLINE void sb_append_html_escaped(sb *sb, char *s, int n)
+{
+  sb_append_markup_escaped(sb, s, n, 0);
+}
+
+/* Escapes & < > " ' with the five predefined XML entities */
+SB_API SB_INLINE void sb_append_xml_escaped(sb *sb, char *s, int n)
+{
+  sb_append_markup_escaped(sb, s, n, 1);
+}
+
+/* RFC 3986 percent-encoding: everything except A-Z a-z 0-9 - _ . ~ becomes %XX */
+SB_API SB_INLINE void sb_append_url_encoded(sb *sb, char *s, int n)
+{
+  unsigned char *u = (unsigned char *)s;
+  int i = 0;
+
+  while (i < n)
+  {
+    int j = i;
+    char esc[3];
+
+    while (j < n && !(SB_LUT_ESCAPE[u[j]] & SB_ESCAPE_URL))
+    {
+      j++;
+    }
+
+    sb_append_bytes(sb, s + i, j - i);
+
+    if (j == n)
+    {
+      break;
+    }
+
+    esc[0] = '%';
+    esc[1] = SB_LUT_HEX_UPPER[0][(u[j] >> 4) * 2u + 1u];
+    esc[2] = SB_LUT_HEX_UPPER[0][(u[j] & 15u) * 2u + 1u];
+    sb_append_bytes(sb, esc, 3);
+
+    i = j + 1;
+  }
+}
+
+SB_API SB_INLINE int sb_hex_digit_value(unsigned char c)
+{
+  if (c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+
+  c |= 0x20; /* lowercase */
+
+  if (c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
+  }
+
+  return -1;
+}
+
+/* Decodes %XX sequences of s in place. Returns the new length or -1 on a malformed sequence. */
+SB_API SB_INLINE int sb_url_decode_inplace(char *s, int n)
+{
+  int r = 0;
+  int w;
+
+  /* Nothing moves until the first escape */
+  while (r < n && s[r] != '%')
+  {
+    r++;
+  }
+
+  w = r;
+
+  while (r < n)
+  {
+    if (s[r] == '%')
+    {
+      int hi;
+      int lo;
+
+      if (r + 2 >= n)
+      {
+        return -1;
+      }
+
+      hi = sb_hex_digit_value((unsigned char)s[r + 1]);
+      lo = sb_hex_digit_value((unsigned char)s[r + 2]);
+
+      if ((hi | lo) < 0)
+      {
+        return -1;
+      }
+
+      s[w++] = (char)((hi << 4) | lo);
+      r += 3;
+    }
+    else
+    {
+      s[w++] = s[r++];
+    }
+  }
+
+  return w;
+}
+
+/* #############################################################################
+ * # ARENA
+ * #############################################################################
+ */
+typedef struct sb_view
+{
+  char *ptr;   /* Start of the string (null terminated when it comes from an sb_arena) */
+  sb_size len; /* Length without the terminator */
+
+} sb_view;
+
+SB_API SB_INLINE sb_u64 sb_hash64_str(sb_view v)
+{
+  return sb_hash64_bytes(v.ptr, v.len, 0);
+}
+
+typedef struct sb_arena
+{
+  char *buf;    /* Backing memory */
+  sb_size cap;  /* Capacity of the backing memory */
+  sb_size used; /* Bytes taken by finished strings */
+  int ovr;      /* Overflow flag (1 if a string did not fit) */
+
+} sb_arena;
+
+SB_API SB_INLINE void sb_arena_init(sb_arena *a, char *buffer, sb_size capacity)
+{
+  a->buf = buffer;
+  a->cap = (capacity > 0) ? capacity : 0;
+  a->used = 0;
+  a->ovr = 0;
+}
+
+/* Starts a builder at the arena tail, use any sb_append_* on it afterwards */
+SB_API SB_INLINE void sb_arena_begin(sb_arena *a, sb *sb)
+{
+  sb_init(sb, a->buf + a->used, a->cap - a->used);
+}
+
+/* Finishes the builder and keeps its bytes in place. Returns a stable view, or an empty
+ * view ({0, 0}) and sets the arena overflow flag if the string did not fit.
+ */
+SB_API SB_INLINE sb_view sb_arena_end(sb_arena *a, sb *sb)
+{
+  sb_view v;
+
+  if (sb->len >= sb->cap)
+  {
+    a->ovr = 1;
+    v.ptr = 0;
+    v.len = 0;
+    return v;
+  }
+
+  sb->buf[sb->len] = '\0';
+
+  v.ptr = sb->buf;
+  v.len = sb->len;
+  a->used += sb->len + 1;
+
+  return v;
+}
+
+/* Drops all strings of the current batch, their views become invalid */
+SB_API SB_INLINE void sb_arena_reset(sb_arena *a)
+{
+  a->used = 0;
+  a->ovr = 0;
+}
+
+/* #############################################################################
+ * # STRING INTERNING
+ * #############################################################################
+ */
+typedef struct sb_intern_slot
+{
+  char *ptr;         /* Canonical string in the arena (0 = empty slot) */
+  sb_size len;       /* Length of the string */
+  unsigned int hash; /* Low 32 bits of the hash, checked before comparing bytes */
+
+} sb_intern_slot;
+
+typedef struct sb_intern
+{
+  sb_arena *arena;       /* Storage for the unique strings */
+  sb_intern_slot *slots; /* Open addressing table (linear probing) */
+  int mask;              /* Slot count - 1, the slot count is a power of two (-1 if init failed) */
+  int count;             /* Number of unique strings */
+  int ovr;               /* Overflow flag (1 if the table or the arena was full) */
+
+} sb_intern;
+
+/* slot_count must be a power of two up to 2^29, the table is kept at most 3/4 full.
+ * Returns 0, or -1 for a missing or badly sized slot array (the table then refuses every string).
+ */
+SB_API SB_INLINE int sb_intern_init(sb_intern *t, sb_intern_slot *slots, int slot_count, sb_arena *arena)
+{
+  int i;
+
+  t->arena = arena;
+  t->slots = slots;
+  t->mask = -1;
+  t->count = 0;
+  t->ovr = 1;
+
+  if (!slots || slot_count < 1 || slot_count > (1 << 29) || (slot_count & (slot_count - 1)) != 0)
+  {
+    return -1;
+  }
+
+  t->mask = slot_count - 1;
+  t->ovr = 0;
+
+  for (i = 0; i < slot_count; ++i)
+  {
+    slots[i].ptr = 0;
+    slots[i].len = 0;
+    slots[i].hash = 0;
+  }
+
+  return 0;
+}
+
+/* Probes for s. Returns the matching slot or the empty slot where it belongs. */
+SB_API SB_INLINE sb_intern_slot *sb_intern_find(sb_intern *t, char *s, sb_size n, sb_u64 h)
+{
+  unsigned int h32 = (unsigned int)(h & 0xfffffffful);
+  unsigned int i = (unsigned int)(h >> 32) & (unsigned int)t->mask;
+
+  for (;;)
+  {
+    sb_intern_slot *slot = &t->slots[i];
+
+    if (slot->ptr == 0)
+    {
+      return slot;
+    }
+
+    if (slot->hash == h32 && slot->len == n)
+    {
+      sb_size k = 0;
+
+      while (k < n && slot->ptr[k] == s[k])
+      {
+        k++;
+      }
+
+      if (k == n)
+      {
+        return slot;
+      }
+    }
+
+    i = (i + 1u) & (unsigned int)t->mask;
+  }
+}
+
+SB_API SB_INLINE sb_view sb_intern_slot_view(sb_intern_slot *slot)
+{
+  sb_view v;
+  v.ptr = slot->ptr;
+  v.len = slot->len;
+  return v;
+}
+
+/* Sets the overflow flag and returns the empty view */
+SB_API SB_INLINE sb_view sb_intern_fail(sb_intern *t)
+{
+  sb_view v;
+  t->ovr = 1;
+  v.ptr = 0;
+  v.len = 0;
+  return v;
+}
+
+/* Returns the canonical view of the n bytes at s, copying them into the arena once if they are new.
+ * Returns an empty view and sets the overflow flag if the table or the arena is full.
+ */
+SB_API SB_INLINE sb_view sb_intern_bytes(sb_intern *t, char *s, sb_size n)
+{
+  sb_u64 h;
+  sb_intern_slot *slot;
+  sb_view v;
+  sb tmp;
+
+  if (t->mask < 0)
+  {
+    return sb_intern_fail(t);
+  }
+
+  h = sb_hash64_bytes(s, n, 0);
+  slot = sb_intern_find(t, s, n, h);
+
+  if (slot->ptr)
+  {
+    return sb_intern_slot_view(slot);
+  }
+
+  if ((t->count + 1) * 4 > (t->mask + 1) * 3)
+  {
+    return sb_intern_fail(t);
+  }
+
+  sb_arena_begin(t->arena, &tmp);
+  sb_append_bytes(&tmp, s, n);
+  v = sb_arena_end(t->arena, &tmp);
+
+  if (v.ptr == 0)
+  {
+    t->ovr = 1;
+    return v;
+  }
+
+  slot->ptr = v.ptr;
+  slot->len = v.len;
+  slot->hash = (unsigned int)(h & 0xfffffffful);
+  t->count++;
+
+  return v;
+}
+
+/* Interns the content of a builder. If the builder was started with sb_arena_begin on the table's arena
+ * a new string is committed in place (no copy) and a duplicate is simply dropped from the arena tail.
+ */
+SB_API SB_INLINE sb_view sb_intern_end(sb_intern *t, sb *sb)
+{
+  sb_arena *a = t->arena;
+  sb_u64 h;
+  sb_intern_slot *slot;
+  sb_view v;
+
+  if (t->mask < 0)
+  {
+    return sb_intern_fail(t);
+  }
+
+  if (sb->buf != a->buf + a->used || sb->len >= sb->cap)
+  {
+    /* Not at the arena tail (or overflowed): fall back to copying */
+    if (sb->len >= sb->cap)
+    {
+      return sb_intern_fail(t);
+    }
+
+    return sb_intern_bytes(t, sb->buf, sb->len);
+  }
+
+  h = sb_hash64_bytes(sb->buf, sb->len, 0);
+  slot = sb_intern_find(t, sb->buf, sb->len, h);
+
+  if (slot->ptr)
+  {
+    return sb_intern_slot_view(slot);
+  }
+
+  if ((t->count + 1) * 4 > (t->mask + 1) * 3)
+  {
+    return sb_intern_fail(t);
+  }
+
+  v = sb_arena_end(a, sb);
+  slot->ptr = v.ptr;
+  slot->len = v.len;
+  slot->hash = (unsigned int)(h & 0xfffffffful);
+  t->count++;
+
+  return v;
+}
+
+/* #############################################################################
+ * # MESSAGEPACK WRITER
+ * #############################################################################
+ */
+#ifndef SB_MSGPACK_MAX_DEPTH
+#define SB_MSGPACK_MAX_DEPTH 32
+#endif
+
+typedef struct sb_msgpack_frame
+{
+  sb_slot head; /* Reserved header of an open container (width 0 for counted ones) */
+  int count;    /* Values written (keys and values for maps) */
+  int expect;   /* Values announced by sb_msgpack_array/map, -1 if open */
+  int map;      /* 1 for maps */
+
+} sb_msgpack_frame;
+
+typedef struct sb_msgpack
+{
+  sb *sb;                                        /* Output string builder */
+  int depth;                                     /* Current nesting depth */
+  int err;                                       /* Error flag (1 on nesting misuse) */
+  sb_msgpack_frame stack[SB_MSGPACK_MAX_DEPTH]; /* Containers being written */
+
+} sb_msgpack;
+
+SB_API SB_INLINE void sb_msgpack_init(sb_msgpack *mp, sb *sb)
+{
+  mp->sb = sb;
+  mp->depth = 0;
+  mp->err = 0;
+}
+
+/* Type byte followed by an n byte big endian argument */
+SB_API SB_INLINE void sb_msgpack_put(sb_msgpack *mp, unsigned int type, sb_u64 v, int n)
+{
+  sb_putc(mp->sb, (char)type);
+  sb_append_fixed(mp->sb, v, n, 1);
+}
+
+/* Marks one value as complete and closes counted containers that are now full */
+SB_API SB_INLINE void sb_msgpack_done(sb_msgpack *mp)
+{
+  while (mp->depth > 0)
+  {
+    sb_msgpack_frame *f = &mp->stack[mp->depth - 1];
+
+    f->count++;
+
+    if (f->expect < 0 || f->count < f->expect)
+    {
+      return;
+    }
+
+    mp->depth--;
+  }
+}
+
+/* Writes the smallest of fixed / 16 / 32 bit header forms for a length */
+SB_API SB_INLINE void sb_msgpack_head(sb_msgpack *mp, unsigned int fix, unsigned int fix_max, unsigned int t8, unsigned int t16, unsigned int t32, unsigned long n)
+{
+  if (n <= fix_max)
+  {
+    sb_putc(mp->sb, (char)(fix | n));
+  }
+  else if (t8 && n <= 0xfful)
+  {
+    sb_msgpack_put(mp, t8, n, 1);
+  }
+  else if (n <= 0xfffful)
+  {
+    sb_msgpack_put(mp, t16, n, 2);
+  }
+  else
+  {
+    sb_msgpack_put(mp, t32, n, 4);
+  }
+}
+
+SB_API SB_INLINE void sb_msgpack_push(sb_msgpack *mp, int map, int expect, sb_slot head)
+{
+  sb_msgpack_frame *f;
+
+  if (mp->depth >= SB_MSGPACK_MAX_DEPTH)
+  {
+    mp->err = 1;
+    return;
+  }
+
+  f = &mp->stack[mp->depth++];
+  f->head = head;
+  f->count = 0;
+  f->expect = expect;
+  f->map = map;
+
+  if (expect == 0)
+  {
+    mp->depth--;
+    sb_msgpack_done(mp);
+  }
+}
+
+/* Container with a known number of elements (pairs for maps), smallest header */
+SB_API SB_INLINE void sb_msgpack_array(sb_msgpack *mp, int n)
+{
+  sb_slot none;
+
+  none.pos = mp->sb->len;
+  none.width = 0;
+  sb_msgpack_head(mp, 0x90u, 15u, 0, 0xdcu, 0xddu, (unsigned long)n);
+  sb_msgpack_push(mp, 0, n, none);
+}
+
+SB_API SB_INLINE void sb_msgpack_map(sb_msgpack *mp, int n)
+{
+  sb_slot none;
+
+  none.pos = mp->sb->len;
+  none.width = 0;
+  sb_msgpack_head(mp, 0x80u, 15u, 0, 0xdeu, 0xdfu, (unsigned long)n);
+  sb_msgpack_push(mp, 1, n * 2, none);
+}
+
+/* Container whose length is unknown: reserves a 32 bit header and patches it at the end */
+SB_API SB_INLINE void sb_msgpack_array_begin(sb_msgpack *mp)
+{
+  sb_msgpack_push(mp, 0, -1, sb_reserve_slot(mp->sb, 5));
+}
+
+SB_API SB_INLINE void sb_msgpack_map_begin(sb_msgpack *mp)
+{
+  sb_msgpack_push(mp, 1, -1, sb_reserve_slot(mp->sb, 5));
+}
+
+SB_API SB_INLINE void sb_msgpack_end(sb_msgpack *mp, int map)
+{
+  sb_msgpack_frame *f;
+  char *p;
+
+  if (mp->depth == 0)
+  {
+    mp->err = 1;
+    return;
+  }
+
+  f = &mp->stack[mp->depth - 1];
+
+  if (f->expect >= 0 || f->map != map || (map && (f->count & 1)))
+  {
+    mp->err = 1;
+    return;
+  }
+
+  /* Not stored when the builder overflowed, ovr already reports that */
+  p = sb_slot_ptr(mp->sb, f->head);
+
+  if (p)
+  {
+    p[0] = (char)(map ? 0xdfu : 0xddu);
+    sb_store_be(p + 1, (sb_u64)(map ? f->count / 2 : f->count), 4);
+  }
+
+  mp->depth--;
+  sb_msgpack_done(mp);
+}
+
+SB_API SB_INLINE void sb_msgpack_array_end(sb_msgpack *mp)
+{
+  sb_msgpack_end(mp, 0);
+}
+
+SB_API SB_INLINE void sb_msgpack_map_end(sb_msgpack *mp)
+{
+  sb_msgpack_end(mp, 1);
+}
+
+SB_API SB_INLINE void sb_msgpack_nil(sb_msgpack *mp)
+{
+  sb_putc(mp->sb, (char)0xc0);
+  sb_msgpack_done(mp);
+}
+
+SB_API SB_INLINE void sb_msgpack_bool(sb_msgpack *mp, int v)
+{
+  sb_putc(mp->sb, (char)(v ? 0xc3 : 0xc2));
+  sb_msgpack_done(mp);
+}
+
+SB_API SB_INLINE void sb_msgpack_uint(sb_msgpack *mp, sb_u64 v)
+{
+  if (v <= 0x7fu)
+  {
+    sb_putc(mp->sb, (char)v);
+  }
+  else if (v <= 0xffu)
+  {
+    sb_msgpack_put(mp, 0xccu, v, 1);
+  }
+  else if (v <= 0xffffu)
+  {
+    sb_msgpack_put(mp, 0xcdu, v, 2);
+  }
+  else if (v <= 0xfffffffful)
+  {
+    sb_msgpack_put(mp, 0xceu, v, 4);
+  }
+  else
+  {
+    sb_msgpack_put(mp, 0xcfu, v, 8);
+  }
+
+  sb_msgpack_done(mp);
+}
+
+SB_API SB_INLINE void sb_msgpack_int(sb_msgpack *mp, sb_i64 v)
+{
+  sb_u64 u = (sb_u64)v;
+
+  if (v >= 0)
+  {
+    sb_msgpack_uint(mp, u);
+    return;
+  }
+
+  if (v >= -32)
+  {
+    sb_putc(mp->sb, (char)(u & 0xffu));
+  }
+  else if (v >= -128)
+  {
+    sb_msgpack_put(mp, 0xd0u, u, 1);
+  }
+  else if (v >= -32768)
+  {
+    sb_msgpack_put(mp, 0xd1u, u, 2);
+  }
+  else if (v >= -2147483647L - 1L)
+  {
+    sb_msgpack_put(mp, 0xd2u, u, 4);
+  }
+  else
+  {
+    sb_msgpack_put(mp, 0xd3u, u, 8);
+  }
+
+  sb_msgpack_done(mp);
+}
+
+/* float 32 when the value survives the narrowing exactly, float 64 otherwise (also NaN and infinities) */
+SB_API SB_INLINE void sb_msgpack_double(sb_msgpack *mp, double x)
+{
+  union
+  {
+    float f;
+    unsigned int u;
+  } f32;
+  sb_f64_bits f64;
+
+  /* Narrowing a value outside the float range is undefined, only try it within +-FLT_MAX */
+  if (x >= -3.4028234663852886e38 && x <= 3.4028234663852886e38)
+  {
+    f32.f = (float)x;
+
+    if ((double)f32.f == x)
+    {
+      sb_msgpack_put(mp, 0xcau, f32.u, 4);
+      sb_msgpack_done(mp);
+      return;
+    }
+  }
+
+  f64.d = x;
+  sb_msgpack_put(mp, 0xcbu, f64.u, 8);
+  sb_msgpack_done(mp);
+}
+
+SB_API SB_INLINE void sb_msgpack_str_n(sb_msgpack *mp, char *s, int n)
+{
+  sb_msgpack_head(mp, 0xa0u, 31u, 0xd9u, 0xdau, 0xdbu, (unsigned long)n);
+  sb_append_bytes(mp->sb, s, n);
+  sb_msgpack_done(mp);
+}
+
+SB_API SB_INLINE void sb_msgpack_str(sb_msgpack *mp, char *s)
+{
+  int n = 0;
+
+  while (s[n] != '\0')
+  {
+    n++;
+  }
+
+  sb_msgpack_str_n(mp, s, n);
+}
+
+SB_API SB_INLINE void sb_msgpack_bin(sb_msgpack *mp, char *p, int n)
+{
+  if (n <= 0xff)
+  {
+    sb_msgpack_put(mp, 0xc4u, (sb_u64)n, 1);
+  }
+  else if (n <= 0xffff)
+  {
+    sb_msgpack_put(mp, 0xc5u, (sb_u64)n, 2);
+  }
+  else
+  {
+    sb_msgpack_put(mp, 0xc6u, (sb_u64)n, 4);
+  }
+
+  sb_append_bytes(mp->sb, p, n);
+  sb_msgpack_done(mp);
+}
+
+/* #############################################################################
+ * # MEMORY MAPPED FILE BUILDER
+ * #############################################################################
+ */
+#ifdef SB_LINUX_SYSCALLS
+#define SB_MAP_HUGEPAGE 1   /* madvise(MADV_HUGEPAGE) the mapping */
+#define SB_MAP_SEQUENTIAL 2 /* madvise(MADV_SEQUENTIAL) the mapping */
+
+#ifndef SB_MAP_GRANULE
+#define SB_MAP_GRANULE 65536 /* File and mapping sizes are multiples of this (power of two) */
+#endif
+
+/* Builder whose buffer is a shared mapping of a file: the formatted bytes are the file */
+typedef struct sb_map
+{
+  sb sb;          /* Builder over the mapping, use any sb_append_* on it */
+  long fd;        /* File descriptor */
+  sb_size mapped; /* Current size of the file and the mapping */
+  int flags;      /* SB_MAP_* flags */
+  int err;        /* Last error (positive errno), 0 if none */
+
+} sb_map;
+
+SB_API SB_INLINE sb_size sb_map_round(sb_size n)
+{
+  return (n + (SB_MAP_GRANULE - 1)) & ~(sb_size)(SB_MAP_GRANULE - 1);
+}
+
+SB_API SB_INLINE int sb_map_fail(sb_map *m, long r)
+{
+  m->err = (int)-r;
+  return -1;
+}
+
+SB_API SB_INLINE void sb_map_advise(sb_map *m)
+{
+  if (m->flags & SB_MAP_HUGEPAGE)
+  {
+    sb_syscall3(SB_SYS_MADVISE, (long)m->sb.buf, (long)m->mapped, 14); /* MADV_HUGEPAGE */
+  }
+
+  if (m->flags & SB_MAP_SEQUENTIAL)
+  {
+    sb_syscall3(SB_SYS_MADVISE, (long)m->sb.buf, (long)m->mapped, 2); /* MADV_SEQUENTIAL */
+  }
+}
+
+/* Creates (or truncates) the file at path and maps capacity bytes of it. Returns 0 or -1 (m->err is set). */
+SB_API SB_INLINE int sb_map_open(sb_map *m, char *path, sb_size capacity, int flags)
+{
+  long r;
+
+  m->fd = -1;
+  m->mapped = sb_map_round(capacity > 0 ? capacity : 1);
+  m->flags = flags;
+  m->err = 0;
+  sb_init(&m->sb, 0, 0);
+
+  /* O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 */
+  r = sb_syscall6(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 02 | 0100 | 01000 | 02000000, 0644, 0, 0);
+
+  if (sb_syscall_failed(r))
+  {
+    return sb_map_fail(m, r);
+  }
+
+  m->fd = r;
+  r = sb_syscall3(SB_SYS_FTRUNCATE, m->fd, (long)m->mapped, 0);
+
+  if (!sb_syscall_failed(r))
+  {
+    /* PROT_READ | PROT_WRITE, MAP_SHARED */
+    r = sb_syscall6(SB_SYS_MMAP, 0, (long)m->mapped, 1 | 2, 1, m->fd, 0);
+  }
+
+  if (sb_syscall_failed(r))
+  {
+    sb_syscall3(SB_SYS_CLOSE, m->fd, 0, 0);
+    m->fd = -1;
+    return sb_map_fail(m, r);
+  }
+
+  sb_init(&m->sb, (char *)r, m->mapped);
+  sb_map_advise(m);
+
+  return 0;
+}
+
+/* Makes room for n more bytes, growing the file with ftruncate and the mapping with mremap
+ * (at least doubling). Call it before appends of a known maximum size, sb_map_format grows on its
+ * own. Returns 0 or -1, also once the builder has overflowed.
+ */
+SB_API SB_INLINE int sb_map_reserve(sb_map *m, sb_size n)
+{
+  sb_size want;
+  long r;
+
+  if (m->sb.ovr || !m->sb.buf)
+  {
+    return sb_map_fail(m, m->sb.buf ? -28 : -9); /* ENOSPC: bytes were already lost, EBADF: finalized */
+  }
+
+  if (m->sb.cap - m->sb.len >= n)
+  {
+    return 0;
+  }
+
+  if (m->fd < 0 || n > SB_SIZE_MAX - m->sb.len - SB_MAP_GRANULE)
+  {
+    return sb_map_fail(m, -27); /* EFBIG */
+  }
+
+  want = sb_map_round(m->sb.len + n);
+
+  if (m->mapped <= SB_SIZE_MAX / 2 && want < m->mapped * 2)
+  {
+    want = m->mapped * 2;
+  }
+
+  r = sb_syscall3(SB_SYS_FTRUNCATE, m->fd, (long)want, 0);
+
+  if (!sb_syscall_failed(r))
+  {
+    /* MREMAP_MAYMOVE: the kernel moves the page table entries, the content is never copied */
+    r = sb_syscall6(SB_SYS_MREMAP, (long)m->sb.buf, (long)m->mapped, (long)want, 1, 0, 0);
+  }
+
+  if (sb_syscall_failed(r))
+  {
+    return sb_map_fail(m, r);
+  }
+
+  m->sb.buf = (char *)r;
+  m->sb.cap = want;
+  m->mapped = want;
+  sb_map_advise(m);
+
+  return 0;
+}
+
+/* Appends len bytes of src, growing the file first. Returns 0 or -1 (m->err is set, nothing is appended). */
+SB_API SB_INLINE int sb_map_append_bytes(sb_map *m, char *src, sb_size len)
+{
+  if (sb_map_reserve(m, len) != 0)
+  {
+    return -1;
+  }
+
+  sb_append_bytes(&m->sb, src, len);
+
+  return 0;
+}
+
+/* Runs format(&m->sb, ctx), any sequence of sb_append_* calls. If its output did not fit, it is
+ * discarded, the file grows to the size the builder counted and format runs again, so it has to
+ * produce the same bytes on every call. Returns 0 or -1 (m->err is set).
+ */
+SB_API SB_INLINE int sb_map_format(sb_map *m, void (*format)(sb *sb, void *ctx), void *ctx)
+{
+  sb_size mark = m->sb.len;
+  sb_size need;
+
+  if (sb_map_reserve(m, 0) != 0)
+  {
+    return -1;
+  }
+
+  format(&m->sb, ctx);
+
+  if (!m->sb.ovr)
+  {
+    return 0;
+  }
+
+  need = m->sb.len - mark;
+  m->sb.len = mark;
+  m->sb.ovr = 0;
+
+  if (sb_map_reserve(m, need) != 0)
+  {
+    /* Keep the overflow so sb_map_term reports the lost bytes */
+    m->sb.len = mark + need;
+    m->sb.ovr = 1;
+    return -1;
+  }
+
+  format(&m->sb, ctx);
+
+  return m->sb.ovr ? sb_map_fail(m, -28) : 0; /* ENOSPC: format was not deterministic */
+}
+
+/* Finalizes the file to the exact stored length. Use it instead of sb_term (no terminator is written).
+ * The mapping is released first, the builder only counts afterwards. Returns -1 with m->err set to
+ * ENOSPC if the builder overflowed (an append outside sb_map_format without a prior sb_map_reserve did not fit).
+ */
+SB_API SB_INLINE int sb_map_term(sb_map *m)
+{
+  sb_size stored;
+  long r;
+
+  if (m->fd < 0)
+  {
+    return -1;
+  }
+
+  if (!m->sb.buf)
+  {
+    return m->err ? -1 : 0; /* Already finalized */
+  }
+
+  stored = (m->sb.len < m->sb.cap) ? m->sb.len : m->sb.cap;
+
+  if (m->sb.ovr || m->sb.len > m->sb.cap)
+  {
+    m->sb.ovr = 1;
+    m->err = 28; /* ENOSPC */
+  }
+
+  /* Unmap before shrinking the file, touching pages past the new end of file raises SIGBUS */
+  sb_syscall3(SB_SYS_MUNMAP, (long)m->sb.buf, (long)m->mapped, 0);
+  m->sb.buf = 0;
+  m->sb.cap = 0;
+  m->mapped = 0;
+
+  r = sb_syscall3(SB_SYS_FTRUNCATE, m->fd, (long)stored, 0);
+
+  if (sb_syscall_failed(r))
+  {
+    return sb_map_fail(m, r);
+  }
+
+  return m->err ? -1 : 0;
+}
+
+/* sb_map_term, then unmaps and closes the file. Returns 0 or -1. */
+SB_API SB_INLINE int sb_map_close(sb_map *m)
+{
+  int result = sb_map_term(m);
+
+  if (m->fd >= 0)
+  {
+    sb_syscall3(SB_SYS_CLOSE, m->fd, 0, 0);
+  }
+
+  m->fd = -1;
+  sb_init(&m->sb, 0, 0);
+
+  return result;
+}
+#endif
+
+/* #############################################################################
+ * # THREADS
+ * #############################################################################
+ */
+#ifdef SB_LINUX_SYSCALLS
+#ifndef SB_THREAD_STACK
+#define SB_THREAD_STACK 65536 /* Stack size of raw threads */
+#endif
+
+/* Sleeps while *addr == val (private futex). Spurious wakeups are possible, callers recheck. */
+SB_API SB_INLINE void sb_futex_wait(unsigned int *addr, unsigned int val)
+{
+  sb_syscall6(SB_SYS_FUTEX, (long)addr, 128, (long)val, 0, 0, 0); /* FUTEX_WAIT_PRIVATE */
+}
+
+SB_API SB_INLINE void sb_futex_wake(unsigned int *addr)
+{
+  sb_syscall6(SB_SYS_FUTEX, (long)addr, 129, 0x7fffffff, 0, 0, 0); /* FUTEX_WAKE_PRIVATE, all */
+}
+
+/* Thread implementation (pthreads, Win32, a scheduler, ...), SB_THREAD_SHIM_RAW uses raw clone threads */
+typedef struct sb_thread_shim
+{
+  void *ctx;                                                /* Passed to spawn and join */
+  void *(*spawn)(void *ctx, void (*fn)(void *), void *arg); /* Starts fn(arg), returns a handle or 0 on failure */
+  void (*join)(void *ctx, void *handle);                    /* Waits for the thread behind handle */
+
+} sb_thread_shim;
+
+/* A started thread */
+typedef struct sb_thread
+{
+  sb_thread_shim *shim; /* Shim that started the thread */
+  void *handle;         /* Its handle, 0 once joined */
+
+} sb_thread;
+
+/* clone + call fn(arg) on the new stack + exit, the child never returns into C code of the parent */
+SB_API SB_INLINE long sb_thread_clone(void (*fn)(void *), void *arg, char *stack_top, unsigned int *ctid)
+{
+  /* CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | CLONE_SYSVSEM | CLONE_CHILD_CLEARTID */
+  long flags = 0x100 | 0x200 | 0x400 | 0x800 | 0x10000 | 0x40000 | 0x200000;
+#if defined(__x86_64__)
+  long ret;
+  register long r10 __asm__("r10") = (long)ctid;
+  register long r8 __asm__("r8") = 0;
+  register void (*r12)(void *) __asm__("r12") = fn;
+  register void *r13 __asm__("r13") = arg;
+  __asm__ __volatile__("syscall\n\t"
+                       "test %%rax, %%rax\n\t"
+                       "jnz 1f\n\t"
+                       "xor %%ebp, %%ebp\n\t"
+                       "mov %%r13, %%rdi\n\t"
+                       "call *%%r12\n\t"
+                       "mov $60, %%eax\n\t"
+                       "xor %%edi, %%edi\n\t"
+                       "syscall\n\t"
+                       "1:\n\t"
+                       : "=a"(ret)
+                       : "a"(SB_SYS_CLONE), "D"(flags), "S"(stack_top), "d"(0), "r"(r10), "r"(r8), "r"(r12), "r"(r13)
+                       : "rcx", "r11", "memory");
+  return ret;
+#else
+  register long x8 __asm__("x8") = SB_SYS_CLONE;
+  register long x0 __asm__("x0") = flags;
+  register long x1 __asm__("x1") = (long)stack_top;
+  register long x2 __asm__("x2") = 0;
+  register long x3 __asm__("x3") = 0;
+  register long x4 __asm__("x4") = (long)ctid;
+  register void (*x10)(void *) __asm__("x10") = fn;
+  register void *x11 __asm__("x11") = arg;
+  __asm__ __volatile__("svc 0\n\t"
+                       "cbnz x0, 1f\n\t"
+                       "mov x0, x11\n\t"
+                       "mov x29, #0\n\t"
+                       "blr x10\n\t"
+                       "mov x8, #93\n\t"
+                       "mov x0, #0\n\t"
+                       "svc 0\n\t"
+                       "1:\n\t"
+                       : "+r"(x0)
+                       : "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x10), "r"(x11)
+                       : "x30", "memory", "cc");
+  return x0;
+#endif
+}
+
+/* Raw thread: a private mmap'ed stack of SB_THREAD_STACK bytes whose lowest word is the tid the kernel
+ * clears on exit (CLONE_CHILD_CLEARTID). The thread shares the caller's TLS, so fn must not call into
+ * libc (errno, malloc, stdio, ...) and has to live with the small stack. sb's own threads only do syscalls.
+ */
+SB_API SB_INLINE void *sb_thread_raw_spawn(void *ctx, void (*fn)(void *), void *arg)
+{
+  /* PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK */
+  long r = sb_syscall6(SB_SYS_MMAP, 0, SB_THREAD_STACK, 1 | 2, 0x02 | 0x20 | 0x20000, -1, 0);
+  char *stack;
+
+  (void)ctx;
+
+  if (sb_syscall_failed(r))
+  {
+    return 0;
+  }
+
+  stack = (char *)r;
+  *(unsigned int *)stack = 1;
+
+  if (sb_syscall_failed(sb_thread_clone(fn, arg, stack + SB_THREAD_STACK, (unsigned int *)stack)))
+  {
+    sb_syscall3(SB_SYS_MUNMAP, (long)stack, SB_THREAD_STACK, 0);
+    return 0;
+  }
+
+  return stack;
+}
+
+SB_API SB_INLINE void sb_thread_raw_join(void *ctx, void *handle)
+{
+  unsigned int *tid = (unsigned int *)handle;
+  unsigned int v;
+
+  (void)ctx;
+
+  /* The kernel wakes CLONE_CHILD_CLEARTID waiters with a shared futex */
+  while ((v = __atomic_load_n(tid, __ATOMIC_ACQUIRE)) != 0)
+  {
+    sb_syscall6(SB_SYS_FUTEX, (long)tid, 0, (long)v, 0, 0, 0); /* FUTEX_WAIT */
+  }
+
+  sb_syscall3(SB_SYS_MUNMAP, (long)handle, SB_THREAD_STACK, 0);
+}
+
+static sb_thread_shim SB_THREAD_SHIM_RAW = {0, sb_thread_raw_spawn, sb_thread_raw_join};
+
+/* Runs fn(arg) on a new thread started by shim (raw when 0). Returns 0 or -1. */
+SB_API SB_INLINE int sb_thread_start(sb_thread *t, sb_thread_shim *shim, void (*fn)(void *), void *arg)
+{
+  t->shim = shim ? shim : &SB_THREAD_SHIM_RAW;
+  t->handle = t->shim->spawn(t->shim->ctx, fn, arg);
+
+  return t->handle ? 0 : -1;
+}
+
+/* Waits until the thread has exited */
+SB_API SB_INLINE void sb_thread_join(sb_thread *t)
+{
+  if (t->handle)
+  {
+    t->shim->join(t->shim->ctx, t->handle);
+    t->handle = 0;
+  }
+}
+#endif
+
+/* #############################################################################
+ * # ASYNC WRITER
+ * #############################################################################
+ */
+#ifdef SB_LINUX_SYSCALLS
+#ifndef SB_WRITER_MAX_BUFFERS
+#define SB_WRITER_MAX_BUFFERS 8
+#endif
+
+/* N buffered writer: the producer appends to sb while a background thread writes filled buffers to fd */
+typedef struct sb_writer
+{
+  sb sb;                               /* Builder over the current buffer, use any sb_append_* on it */
+  long fd;                             /* Output file descriptor */
+  char *mem;                           /* Buffer memory, count buffers of size bytes */
+  sb_size size;                        /* Size of one buffer */
+  int count;                           /* Number of buffers (2 = double buffering) */
+  sb_size lens[SB_WRITER_MAX_BUFFERS]; /* Filled length of each handed off buffer */
+  unsigned int filled;                 /* Buffers handed off (written by the producer) */
+  unsigned int drained;                /* Buffers written out (written by the thread, futex) */
+  unsigned int events;                 /* Bumped on every hand off and on stop (futex) */
+  unsigned int stop;                   /* Set by sb_writer_stop */
+  int err;                             /* First error (positive errno): a failed write (later buffers are dropped)
+                                        * or ENOSPC when a buffer overflowed without sb_writer_reserve */
+  sb_thread thread;                    /* Background writer thread */
+
+} sb_writer;
+
+/* Writes all n bytes, retrying partial writes and EINTR. Returns 0 or -errno. */
+SB_API SB_INLINE long sb_write_all(long fd, char *p, sb_size n)
+{
+  while (n > 0)
+  {
+    long r = sb_syscall3(SB_SYS_WRITE, fd, (long)p, (long)n);
+
+    if (r == -4)
+    {
+      continue;
+    }
+
+    if (r < 0)
+    {
+      return r;
+    }
+
+    p += r;
+    n -= (sb_size)r;
+  }
+
+  return 0;
+}
+
+/* Records the first error, shared between the producer and the writer thread */
+SB_API SB_INLINE void sb_writer_fail(sb_writer *w, int err)
+{
+  int none = 0;
+
+  __atomic_compare_exchange_n(&w->err, &none, err, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+SB_API SB_INLINE int sb_writer_error(sb_writer *w)
+{
+  return __atomic_load_n(&w->err, __ATOMIC_ACQUIRE);
+}
+
+SB_API SB_INLINE void sb_writer_thread(void *arg)
+{
+  sb_writer *w = (sb_writer *)arg;
+  int failed = 0;
+
+  for (;;)
+  {
+    unsigned int events = __atomic_load_n(&w->events, __ATOMIC_ACQUIRE);
+    unsigned int filled = __atomic_load_n(&w->filled, __ATOMIC_ACQUIRE);
+    unsigned int drained = w->drained;
+
+    if (drained == filled)
+    {
+      if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE))
+      {
+        return;
+      }
+
+      sb_futex_wait(&w->events, events);
+      continue;
+    }
+
+    while (drained != filled)
+    {
+      unsigned int i = drained % (unsigned int)w->count;
+
+      if (!failed)
+      {
+        long r = sb_write_all(w->fd, w->mem + (sb_size)i * w->size, w->lens[i]);
+
+        if (r < 0)
+        {
+          failed = 1;
+          sb_writer_fail(w, (int)-r);
+        }
+      }
+
+      drained++;
+      __atomic_store_n(&w->drained, drained, __ATOMIC_RELEASE);
+      sb_futex_wake(&w->drained);
+    }
+  }
+}
+
+/* Points the builder at the next free buffer, waiting while all buffers are in flight (backpressure) */
+SB_API SB_INLINE void sb_writer_next(sb_writer *w)
+{
+  unsigned int drained;
+
+  while (w->filled - (drained = __atomic_load_n(&w->drained, __ATOMIC_ACQUIRE)) >= (unsigned int)w->count)
+  {
+    sb_futex_wait(&w->drained, drained);
+  }
+
+  sb_init(&w->sb, w->mem + (sb_size)(w->filled % (unsigned int)w->count) * w->size, w->size);
+}
+
+/* Hands the current buffer to the writer thread (if it holds anything) and moves to the next one */
+SB_API SB_INLINE void sb_writer_submit(sb_writer *w)
+{
+  if (w->sb.ovr)
+  {
+    sb_writer_fail(w, 28); /* ENOSPC: appended past the buffer without sb_writer_reserve */
+  }
+
+  if (w->sb.len == 0)
+  {
+    return;
+  }
+
+  w->lens[w->filled % (unsigned int)w->count] = (w->sb.len < w->sb.cap) ? w->sb.len : w->sb.cap;
+  __atomic_store_n(&w->filled, w->filled + 1u, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&w->events, 1u, __ATOMIC_RELEASE);
+  sb_futex_wake(&w->events);
+  sb_writer_next(w);
+}
+
+/* Splits mem into count (2..SB_WRITER_MAX_BUFFERS) buffers and starts the writer thread,
+ * a raw clone thread unless a shim is given. Returns 0 or -1.
+ */
+SB_API SB_INLINE int sb_writer_start(sb_writer *w, long fd, char *mem, sb_size mem_size, int count, sb_thread_shim *shim)
+{
+  w->fd = fd;
+  w->mem = mem;
+  w->count = (count < 2) ? 2 : (count > SB_WRITER_MAX_BUFFERS ? SB_WRITER_MAX_BUFFERS : count);
+  w->size = mem_size / w->count;
+  w->filled = 0;
+  w->drained = 0;
+  w->events = 0;
+  w->stop = 0;
+  w->err = 0;
+  sb_writer_next(w);
+
+  return sb_thread_start(&w->thread, shim, sb_writer_thread, w);
+}
+
+/* Makes room for n more bytes, handing off the current buffer when needed.
+ * Returns -1 if n exceeds the buffer size or an error is recorded (w->err) when handing off.
+ */
+SB_API SB_INLINE int sb_writer_reserve(sb_writer *w, sb_size n)
+{
+  if (w->sb.cap - w->sb.len >= n)
+  {
+    return 0;
+  }
+
+  if (n > w->size)
+  {
+    return -1;
+  }
+
+  sb_writer_submit(w);
+
+  return sb_writer_error(w) ? -1 : 0;
+}
+
+/* Barrier: returns once everything appended so far has been written. Returns 0 or -1 (w->err). */
+SB_API SB_INLINE int sb_writer_flush(sb_writer *w)
+{
+  unsigned int drained;
+
+  sb_writer_submit(w);
+
+  while ((drained = __atomic_load_n(&w->drained, __ATOMIC_ACQUIRE)) != w->filled)
+  {
+    sb_futex_wait(&w->drained, drained);
+  }
+
+  return sb_writer_error(w) ? -1 : 0;
+}
+
+/* sb_writer_flush followed by fsync */
+SB_API SB_INLINE int sb_writer_sync(sb_writer *w)
+{
+  long r;
+
+  if (sb_writer_flush(w) != 0)
+  {
+    return -1;
+  }
+
+  r = sb_syscall3(SB_SYS_FSYNC, w->fd, 0, 0);
+
+  if (r < 0)
+  {
+    sb_writer_fail(w, (int)-r);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Flushes, stops and joins the writer thread. The fd stays open. Returns 0 or -1. */
+SB_API SB_INLINE int sb_writer_stop(sb_writer *w)
+{
+  int result = sb_writer_flush(w);
+
+  __atomic_store_n(&w->stop, 1u, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&w->events, 1u, __ATOMIC_RELEASE);
+  sb_futex_wake(&w->events);
+  sb_thread_join(&w->thread);
+
+  return result;
+}
+#endif
+
+/* #############################################################################
+ * # IO_URING SINK
+ * #############################################################################
+ */
+#ifdef SB_LINUX_SYSCALLS
+#ifndef SB_SINK_MAX_BUFFERS
+#define SB_SINK_MAX_BUFFERS 32
+#endif
+
+#define SB_SINK_WRITEV 1 /* Do not try io_uring, always use the writev fallback */
+
+/* Kernel ABI of io_uring (linux/io_uring.h) */
+typedef struct sb_uring_sqe
+{
+  unsigned char opcode;
+  unsigned char flags;
+  unsigned short ioprio;
+  int fd;
+  sb_u64 off;
+  sb_u64 addr;
+  unsigned int len;
+  unsigned int rw_flags;
+  sb_u64 user_data;
+  sb_u64 pad[3];
+
+} sb_uring_sqe;
+
+typedef struct sb_uring_cqe
+{
+  sb_u64 user_data;
+  int res;
+  unsigned int flags;
+
+} sb_uring_cqe;
+
+typedef struct sb_uring_params
+{
+  unsigned int sq_entries;
+  unsigned int cq_entries;
+  unsigned int flags;
+  unsigned int sq_thread_cpu;
+  unsigned int sq_thread_idle;
+  unsigned int features;
+  unsigned int wq_fd;
+  unsigned int resv[3];
+  unsigned int sq_head, sq_tail, sq_ring_mask, sq_ring_entries, sq_flags, sq_dropped, sq_array, sq_resv1;
+  sb_u64 sq_user_addr;
+  unsigned int cq_head, cq_tail, cq_ring_mask, cq_ring_entries, cq_overflow, cq_cqes, cq_flags, cq_resv1;
+  sb_u64 cq_user_addr;
+
+} sb_uring_params;
+
+/* Batched output sink: filled buffers are queued as io_uring writes and recycled after their completion */
+typedef struct sb_sink
+{
+  sb sb;                              /* Builder over the current buffer, use any sb_append_* on it */
+  long fd;                            /* Output file descriptor */
+  char *mem;                          /* Buffer memory, count buffers of size bytes */
+  sb_size size;                       /* Size of one buffer */
+  int count;                          /* Number of buffers */
+  unsigned int filled;                /* Buffers handed off, buffer filled % count is behind sb */
+  int queued;                         /* Handed off but not yet submitted (writev: not yet written) */
+  int busy[SB_SINK_MAX_BUFFERS];      /* Handed off and not completely written */
+  sb_size lens[SB_SINK_MAX_BUFFERS];  /* Handed off bytes of each buffer */
+  sb_size done[SB_SINK_MAX_BUFFERS];  /* Bytes of each buffer written so far */
+  sb_i64 offs[SB_SINK_MAX_BUFFERS];   /* File offset of each buffer (io_uring) */
+  sb_i64 pos;                         /* File offset of the next handed off byte (io_uring) */
+  long syscalls;                      /* io_uring_enter / writev calls issued */
+  int err;                            /* First error (positive errno), ENOSPC when a buffer overflowed */
+  int failed;                         /* A write failed, later buffers are dropped */
+  int uring;                          /* 1 if io_uring is used, 0 for the writev fallback */
+  long ring_fd;
+  char *sq_ring;
+  char *cq_ring;
+  sb_size sq_size;
+  sb_size cq_size;
+  sb_uring_sqe *sqes;
+  sb_size sqes_size;
+  unsigned int *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+  sb_uring_cqe *cqes;
+
+} sb_sink;
+
+/* Records a failed write, everything handed off afterwards is dropped */
+SB_API SB_INLINE void sb_sink_fail(sb_sink *s, int err)
+{
+  if (s->err == 0)
+  {
+    s->err = err;
+  }
+
+  s->failed = 1;
+}
+
+/* 1 if the ring supports IORING_OP_WRITE (Linux 5.6, older kernels have no IORING_REGISTER_PROBE either) */
+SB_API SB_INLINE int sb_sink_uring_probe(long ring_fd)
+{
+  /* struct io_uring_probe: 16 byte header, then 8 bytes per op with the flags at offset 2 */
+  unsigned int probe[4 + 2 * 64] = {0};
+  unsigned char *p = (unsigned char *)probe;
+
+  if (sb_syscall_failed(sb_syscall6(SB_SYS_IO_URING_REGISTER, ring_fd, 8, (long)probe, 64, 0, 0)))
+  {
+    return 0;
+  }
+
+  return p[0] >= 23 && (p[16 + 8 * 23 + 2] & 1u); /* last_op, IO_URING_OP_SUPPORTED */
+}
+
+SB_API SB_INLINE void sb_sink_unmap(sb_sink *s)
+{
+  if (s->sq_ring)
+  {
+    sb_syscall3(SB_SYS_MUNMAP, (long)s->sq_ring, (long)s->sq_size, 0);
+  }
+
+  if (s->cq_ring)
+  {
+    sb_syscall3(SB_SYS_MUNMAP, (long)s->cq_ring, (long)s->cq_size, 0);
+  }
+
+  if (s->sqes)
+  {
+    sb_syscall3(SB_SYS_MUNMAP, (long)s->sqes, (long)s->sqes_size, 0);
+  }
+
+  sb_syscall3(SB_SYS_CLOSE, s->ring_fd, 0, 0);
+  s->sq_ring = 0;
+  s->cq_ring = 0;
+  s->sqes = 0;
+  s->uring = 0;
+}
+
+/* Sets up the rings. Needs a seekable fd since writes carry explicit offsets to keep them ordered.
+ * O_APPEND fds ignore those offsets (a resubmitted short write would land behind later buffers), they stay on writev.
+ */
+SB_API SB_INLINE int sb_sink_uring_setup(sb_sink *s)
+{
+  sb_uring_params p = {0};
+  long r;
+
+  r = sb_syscall3(SB_SYS_FCNTL, s->fd, 3, 0); /* F_GETFL */
+
+  if (sb_syscall_failed(r) || (r & 02000)) /* O_APPEND */
+  {
+    return -1;
+  }
+
+  s->pos = sb_syscall3(SB_SYS_LSEEK, s->fd, 0, 1); /* SEEK_CUR */
+
+  if (sb_syscall_failed(s->pos))
+  {
+    return -1;
+  }
+
+  s->ring_fd = sb_syscall3(SB_SYS_IO_URING_SETUP, s->count, (long)&p, 0);
+
+  if (sb_syscall_failed(s->ring_fd))
+  {
+    return -1;
+  }
+
+  /* Rings from 5.1 - 5.5 would complete every write with EINVAL, stay on writev there */
+  if (!sb_sink_uring_probe(s->ring_fd))
+  {
+    sb_syscall3(SB_SYS_CLOSE, s->ring_fd, 0, 0);
+    s->ring_fd = -1;
+    return -1;
+  }
+
+  s->uring = 1;
+  s->sq_size = (sb_size)(p.sq_array + p.sq_entries * 4);
+  s->cq_size = (sb_size)(p.cq_cqes + p.cq_entries * (unsigned int)sizeof(sb_uring_cqe));
+  s->sqes_size = (sb_size)(p.sq_entries * (unsigned int)sizeof(sb_uring_sqe));
+
+  /* PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE at IORING_OFF_SQ_RING / CQ_RING / SQES */
+  r = sb_syscall6(SB_SYS_MMAP, 0, (long)s->sq_size, 1 | 2, 0x01 | 0x8000, s->ring_fd, 0);
+  s->sq_ring = sb_syscall_failed(r) ? 0 : (char *)r;
+  r = sb_syscall6(SB_SYS_MMAP, 0, (long)s->cq_size, 1 | 2, 0x01 | 0x8000, s->ring_fd, 0x8000000);
+  s->cq_ring = sb_syscall_failed(r) ? 0 : (char *)r;
+  r = sb_syscall6(SB_SYS_MMAP, 0, (long)s->sqes_size, 1 | 2, 0x01 | 0x8000, s->ring_fd, 0x10000000);
+  s->sqes = sb_syscall_failed(r) ? 0 : (sb_uring_sqe *)r;
+
+  if (!s->sq_ring || !s->cq_ring || !s->sqes)
+  {
+    sb_sink_unmap(s);
+    return -1;
+  }
+
+  s->sq_tail = (unsigned int *)(s->sq_ring + p.sq_tail);
+  s->sq_mask = (unsigned int *)(s->sq_ring + p.sq_ring_mask);
+  s->sq_array = (unsigned int *)(s->sq_ring + p.sq_array);
+  s->cq_head = (unsigned int *)(s->cq_ring + p.cq_head);
+  s->cq_tail = (unsigned int *)(s->cq_ring + p.cq_tail);
+  s->cq_mask = (unsigned int *)(s->cq_ring + p.cq_ring_mask);
+  s->cqes = (sb_uring_cqe *)(s->cq_ring + p.cq_cqes);
+
+  return 0;
+}
+
+/* Queues a write of the unwritten rest of buffer i (submitted by the next io_uring_enter) */
+SB_API SB_INLINE void sb_sink_push(sb_sink *s, int i)
+{
+  unsigned int tail = *s->sq_tail;
+  unsigned int slot = tail & *s->sq_mask;
+  sb_uring_sqe *sqe = &s->sqes[slot];
+  sb_size n = s->lens[i] - s->done[i];
+
+  sqe->opcode = 23; /* IORING_OP_WRITE */
+  sqe->flags = 0;
+  sqe->ioprio = 0;
+  sqe->fd = (int)s->fd;
+  sqe->off = (sb_u64)(s->offs[i] + s->done[i]);
+  sqe->addr = (sb_u64)(unsigned long)(s->mem + (sb_size)i * s->size + s->done[i]);
+  sqe->len = (unsigned int)n;
+  sqe->rw_flags = 0;
+  sqe->user_data = (sb_u64)i;
+  sqe->pad[0] = 0;
+  sqe->pad[1] = 0;
+  sqe->pad[2] = 0;
+  s->sq_array[slot] = slot;
+  __atomic_store_n(s->sq_tail, tail + 1u, __ATOMIC_RELEASE);
+  s->queued++;
+}
+
+/* Submits the queued writes, waits for at least one completion and reaps all available ones */
+SB_API SB_INLINE void sb_sink_enter(sb_sink *s)
+{
+  unsigned int head;
+  unsigned int tail;
+  long r = sb_syscall6(SB_SYS_IO_URING_ENTER, s->ring_fd, s->queued, 1, 1, 0, 0); /* IORING_ENTER_GETEVENTS */
+  int i;
+
+  s->syscalls++;
+
+  if (r >= 0)
+  {
+    s->queued -= (int)r;
+  }
+  else if (r != -4 && r != -11 && r != -16) /* EINTR, EAGAIN, EBUSY: retried by the caller */
+  {
+    /* The ring is unusable, drop whatever is in flight */
+    sb_sink_fail(s, (int)-r);
+    s->queued = 0;
+
+    for (i = 0; i < s->count; ++i)
+    {
+      s->busy[i] = 0;
+    }
+
+    return;
+  }
+
+  head = *s->cq_head;
+  tail = __atomic_load_n(s->cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail)
+  {
+    sb_uring_cqe *cqe = &s->cqes[head & *s->cq_mask];
+    int res = cqe->res;
+
+    i = (int)cqe->user_data;
+
+    if (res > 0)
+    {
+      s->done[i] += res;
+    }
+
+    if (res == -4 || res == -11 || (res > 0 && s->done[i] < s->lens[i]))
+    {
+      sb_sink_push(s, i); /* Interrupted or short write, queue the rest */
+    }
+    else
+    {
+      if (res <= 0)
+      {
+        sb_sink_fail(s, res < 0 ? -res : 5); /* EIO for a zero length write */
+      }
+
+      s->busy[i] = 0;
+    }
+
+    head++;
+  }
+
+  __atomic_store_n(s->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Fallback: writes all queued buffers in order with as few writev calls as possible */
+SB_API SB_INLINE void sb_sink_writev(sb_sink *s)
+{
+  struct
+  {
+    char *base;
+    unsigned long len;
+  } iov[SB_SINK_MAX_BUFFERS];
+  unsigned int first = s->filled - (unsigned int)s->queued;
+  int n = s->queued;
+  int k = 0;
+  int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    unsigned int b = (first + (unsigned int)i) % (unsigned int)s->count;
+
+    iov[i].base = s->mem + (sb_size)b * s->size;
+    iov[i].len = (unsigned long)s->lens[b];
+    s->busy[b] = 0;
+  }
+
+  s->queued = 0;
+
+  while (k < n && !s->failed)
+  {
+    long r = sb_syscall3(SB_SYS_WRITEV, s->fd, (long)&iov[k], n - k);
+
+    s->syscalls++;
+
+    if (r == -4)
+    {
+      continue;
+    }
+
+    if (r < 0)
+    {
+      sb_sink_fail(s, (int)-r);
+      break;
+    }
+
+    while (k < n && (unsigned long)r >= iov[k].len)
+    {
+      r -= (long)iov[k].len;
+      k++;
+    }
+
+    if (k < n)
+    {
+      iov[k].base += r;
+      iov[k].len -= (unsigned long)r;
+    }
+  }
+}
+
+/* Makes buffer i reusable, pushing queued buffers out until it has been written */
+SB_API SB_INLINE void sb_sink_wait(sb_sink *s, int i)
+{
+  while (s->busy[i])
+  {
+    if (s->uring)
+    {
+      sb_sink_enter(s);
+    }
+    else
+    {
+      sb_sink_writev(s);
+    }
+  }
+}
+
+/* Hands the current buffer off (if it holds anything) and moves to the next one */
+SB_API SB_INLINE void sb_sink_submit(sb_sink *s)
+{
+  int i = (int)(s->filled % (unsigned int)s->count);
+
+  if (s->sb.ovr && s->err == 0)
+  {
+    s->err = 28; /* ENOSPC: appended past the buffer without sb_sink_reserve */
+  }
+
+  if (s->sb.len == 0)
+  {
+    return;
+  }
+
+  s->lens[i] = (s->sb.len < s->sb.cap) ? s->sb.len : s->sb.cap;
+  s->done[i] = 0;
+  s->filled++;
+
+  if (!s->failed)
+  {
+    s->busy[i] = 1;
+
+    if (s->uring)
+    {
+      s->offs[i] = s->pos;
+      s->pos += s->lens[i];
+      sb_sink_push(s, i);
+    }
+    else
+    {
+      s->queued++;
+    }
+  }
+
+  i = (int)(s->filled % (unsigned int)s->count);
+  sb_sink_wait(s, i);
+  sb_init(&s->sb, s->mem + (sb_size)i * s->size, s->size);
+}
+
+/* Splits mem into count (2..SB_SINK_MAX_BUFFERS) buffers. Uses io_uring for seekable fds not opened
+ * with O_APPEND when the kernel supports its write op, writev otherwise (or with SB_SINK_WRITEV).
+ * Returns 0, or -1 if mem is missing or too small for one byte per buffer.
+ */
+SB_API SB_INLINE int sb_sink_open(sb_sink *s, long fd, char *mem, sb_size mem_size, int count, int flags)
+{
+  int i;
+
+  s->fd = fd;
+  s->mem = mem;
+  s->count = (count < 2) ? 2 : (count > SB_SINK_MAX_BUFFERS ? SB_SINK_MAX_BUFFERS : count);
+  s->size = mem_size / s->count;
+  s->filled = 0;
+  s->queued = 0;
+  s->pos = 0;
+  s->syscalls = 0;
+  s->err = 0;
+  s->failed = 0;
+  s->uring = 0;
+  s->ring_fd = -1;
+  s->sq_ring = 0;
+  s->cq_ring = 0;
+  s->sqes = 0;
+
+  for (i = 0; i < s->count; ++i)
+  {
+    s->busy[i] = 0;
+  }
+
+  if (!mem || s->size < 1)
+  {
+    sb_init(&s->sb, 0, 0);
+    return -1;
+  }
+
+  if (!(flags & SB_SINK_WRITEV))
+  {
+    sb_sink_uring_setup(s);
+  }
+
+  sb_init(&s->sb, mem, s->size);
+
+  return 0;
+}
+
+/* Makes room for n more bytes, handing off the current buffer when needed.
+ * Returns -1 if n exceeds the buffer size or an error is recorded (s->err) when handing off.
+ */
+SB_API SB_INLINE int sb_sink_reserve(sb_sink *s, sb_size n)
+{
+  if (s->sb.cap - s->sb.len >= n)
+  {
+    return 0;
+  }
+
+  if (n > s->size)
+  {
+    return -1;
+  }
+
+  sb_sink_submit(s);
+
+  return s->err ? -1 : 0;
+}
+
+/* Barrier: returns once everything appended so far has been written. Returns 0 or -1 (s->err). */
+SB_API SB_INLINE int sb_sink_flush(sb_sink *s)
+{
+  int i;
+
+  sb_sink_submit(s);
+
+  for (i = 0; i < s->count; ++i)
+  {
+    sb_sink_wait(s, i);
+  }
+
+  if (s->uring)
+  {
+    /* Leave the fd position behind the written data like plain writes would */
+    sb_syscall3(SB_SYS_LSEEK, s->fd, (long)s->pos, 0); /* SEEK_SET */
+  }
+
+  return s->err ? -1 : 0;
+}
+
+/* Flushes and releases the rings. The fd stays open. Returns 0 or -1. */
+SB_API SB_INLINE int sb_sink_close(sb_sink *s)
+{
+  int result = sb_sink_flush(s);
+
+  if (s->uring)
+  {
+    sb_sink_unmap(s);
+  }
+
+  return result;
+}
+#endif
+
+/* #############################################################################
+ * # MPSC RING
+ * #############################################################################
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define SB_RING_HEADER 8 /* Reserved size and commit word in front of every record */
+
+/* Lock-free multi producer, single consumer byte ring. Producers reserve a record with one
+ * atomic fetch-add, format into it with a normal sb and commit it. The consumer drains committed
+ * records in order. Head and tail live on their own cache lines.
+ */
+typedef struct sb_ring
+{
+  char *mem;             /* Ring memory, 8 byte aligned, zeroed by sb_ring_init */
+  unsigned long cap;     /* Power of two capacity */
+  char pad0[64];
+  unsigned long head;    /* Bytes reserved by producers (fetch-add) */
+  char pad1[64];
+  unsigned long tail;    /* Bytes released by the consumer */
+  char pad2[64];
+
+} sb_ring;
+
+/* Uses the largest power of two of capacity (at least 16 bytes). Returns 0 or -1. */
+SB_API SB_INLINE int sb_ring_init(sb_ring *r, char *buffer, sb_size capacity)
+{
+  unsigned long cap = 16;
+  unsigned long i;
+
+  if (capacity < 16)
+  {
+    return -1;
+  }
+
+  while (cap <= (unsigned long)capacity / 2)
+  {
+    cap *= 2;
+  }
+
+  for (i = 0; i < cap; ++i)
+  {
+    buffer[i] = 0;
+  }
+
+  r->mem = buffer;
+  r->cap = cap;
+  r->head = 0;
+  r->tail = 0;
+
+  return 0;
+}
+
+SB_API SB_INLINE void sb_ring_pause(void)
+{
+#ifdef SB_LINUX_SYSCALLS
+  sb_syscall3(SB_SYS_SCHED_YIELD, 0, 0, 0);
+#endif
+}
+
+/* Reserves room for up to n bytes and starts a builder on it, use any sb_append_* on it afterwards.
+ * Waits while the ring is full. Returns -1 if the record can never fit (n + 8 > capacity).
+ */
+SB_API SB_INLINE int sb_ring_begin(sb_ring *r, sb *sb, sb_size n)
+{
+  unsigned long total = ((unsigned long)n + SB_RING_HEADER + 7) & ~7ul;
+
+  if (n < 0 || total > r->cap)
+  {
+    return -1;
+  }
+
+  for (;;)
+  {
+    unsigned long pos = __atomic_fetch_add(&r->head, total, __ATOMIC_RELAXED);
+    unsigned long off = pos & (r->cap - 1);
+    unsigned int *hdr = (unsigned int *)(r->mem + off);
+
+    /* Backpressure: wait until the consumer released the reserved range */
+    while (pos + total - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->cap)
+    {
+      sb_ring_pause();
+    }
+
+    hdr[0] = (unsigned int)total;
+
+    if (off + total <= r->cap)
+    {
+      sb_init(sb, r->mem + off + SB_RING_HEADER, (sb_size)(total - SB_RING_HEADER));
+      return 0;
+    }
+
+    /* The range wraps around the end, publish it as an empty record and reserve again */
+    __atomic_store_n(&hdr[1], 1u, __ATOMIC_RELEASE);
+  }
+}
+
+/* Commits the record started by sb_ring_begin (its stored bytes if the builder overflowed) */
+SB_API SB_INLINE void sb_ring_end(sb_ring *r, sb *sb)
+{
+  unsigned int *hdr = (unsigned int *)(sb->buf - SB_RING_HEADER);
+  sb_size len = (sb->len < sb->cap) ? sb->len : sb->cap;
+
+  (void)r;
+  __atomic_store_n(&hdr[1], (unsigned int)len + 1u, __ATOMIC_RELEASE);
+}
+
+/* Consumer: copies the run of committed records at the tail into out (whole records only, out
+ * must hold the largest record) and releases their space. Returns the number of bytes copied.
+ */
+SB_API SB_INLINE sb_size sb_ring_drain(sb_ring *r, sb *out)
+{
+  unsigned long mask = r->cap - 1;
+  unsigned long start = r->tail;
+  unsigned long pos = start;
+  sb_size copied = 0;
+
+  for (;;)
+  {
+    unsigned int *hdr = (unsigned int *)(r->mem + (pos & mask));
+    unsigned int commit = __atomic_load_n(&hdr[1], __ATOMIC_ACQUIRE);
+    sb_size len = (sb_size)commit - 1;
+
+    if (commit == 0 || out->cap - out->len < len)
+    {
+      break;
     }
-    else
+
+    sb_append_bytes(out, (char *)(hdr + 2), len);
+    copied += len;
+    pos += hdr[0];
+  }
+
+  if (pos != start)
+  {
+    unsigned long p;
+
+    /* Any 8 byte cell can hold a header on the next lap, clear their commit words */
+    for (p = start; p != pos; p += 8)
     {
-      sb_putc(s, *p);
+      ((unsigned int *)(r->mem + (p & mask)))[1] = 0;
     }
 
-    p++;
+    __atomic_store_n(&r->tail, pos, __ATOMIC_RELEASE);
   }
+
+  return copied;
 }
+#endif
 
-SB_API SB_INLINE void sb_printf1(sb *s, char *fmt, char *a1)
+/* #############################################################################
+ * # BUILDER POOL
+ * #############################################################################
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#ifndef SB_POOL_CACHE
+#define SB_POOL_CACHE 16 /* Buffers a per-thread cache holds before spilling half to the pool */
+#endif
+
+/* Fixed size buffers shared by all threads through a lock-free freelist (Treiber stack).
+ * The head is a 64 bit word of a generation tag and the buffer index + 1, the tag changes on
+ * every push and pop so a stale compare-exchange (ABA) fails. The link to the next free buffer
+ * is kept in the first 4 bytes of the free buffer itself.
+ */
+typedef struct sb_pool
 {
-  void *args[1];
-  args[0] = a1;
-  sb_printf(s, fmt, args, 1);
+  char *mem;      /* Buffer memory, count buffers of size bytes */
+  sb_size size;   /* Size of one buffer (multiple of 8) */
+  int count;      /* Number of buffers */
+  char pad0[64];
+  sb_u64 head;    /* Tag << 32 | index + 1 of the first free buffer, 0 when empty */
+  char pad1[64];
+
+} sb_pool;
+
+/* Per-thread cache, owned by one thread (e.g. on its stack), the common case touches nothing shared */
+typedef struct sb_pool_cache
+{
+  sb_pool *pool;
+  int n;                      /* Cached buffers */
+  int items[SB_POOL_CACHE];   /* Cached buffer indices */
+
+} sb_pool_cache;
+
+SB_API SB_INLINE unsigned int *sb_pool_link(sb_pool *p, int i)
+{
+  return (unsigned int *)(p->mem + (sb_size)i * p->size);
 }
 
-SB_API SB_INLINE void sb_printf2(sb *s, char *fmt, char *a1, char *a2)
+SB_API SB_INLINE void sb_pool_push(sb_pool *p, int i)
 {
-  void *args[2];
-  args[0] = a1;
-  args[1] = a2;
-  sb_printf(s, fmt, args, 2);
+  sb_u64 old = __atomic_load_n(&p->head, __ATOMIC_RELAXED);
+  sb_u64 next;
+
+  do
+  {
+    __atomic_store_n(sb_pool_link(p, i), (unsigned int)old, __ATOMIC_RELAXED);
+    next = (((old >> 32) + 1) << 32) | (sb_u64)(i + 1);
+  } while (!__atomic_compare_exchange_n(&p->head, &old, next, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
 
-SB_API SB_INLINE void sb_printf3(sb *s, char *fmt, char *a1, char *a2, char *a3)
+/* Returns a free buffer index or -1 */
+SB_API SB_INLINE int sb_pool_pop(sb_pool *p)
 {
-  void *args[3];
-  args[0] = a1;
-  args[1] = a2;
-  args[2] = a3;
-  sb_printf(s, fmt, args, 3);
+  sb_u64 old = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+  sb_u64 next;
+  unsigned int i;
+
+  do
+  {
+    i = (unsigned int)old;
+
+    if (i == 0)
+    {
+      return -1;
+    }
+
+    /* The buffer may already be taken and rewritten by another thread, the tag makes the CAS fail then */
+    next = (((old >> 32) + 1) << 32) | __atomic_load_n(sb_pool_link(p, (int)i - 1), __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(&p->head, &old, next, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+  return (int)i - 1;
 }
 
-SB_API SB_INLINE void sb_printf4(sb *s, char *fmt, char *a1, char *a2, char *a3, char *a4)
+/* Splits mem into buffers of buffer_size bytes (rounded down to a multiple of 8, at least 8),
+ * all free. Returns the number of buffers.
+ */
+SB_API SB_INLINE int sb_pool_init(sb_pool *p, char *mem, sb_size mem_size, sb_size buffer_size)
 {
-  void *args[4];
-  args[0] = a1;
-  args[1] = a2;
-  args[2] = a3;
-  args[3] = a4;
-  sb_printf(s, fmt, args, 4);
+  int i;
+
+  p->mem = mem;
+  p->size = (buffer_size < 8) ? 8 : (buffer_size & ~(sb_size)7);
+  p->count = (mem_size > 0) ? (int)(mem_size / p->size) : 0;
+  p->head = 0;
+
+  for (i = p->count - 1; i >= 0; --i)
+  {
+    sb_pool_push(p, i);
+  }
+
+  return p->count;
 }
 
-SB_API SB_INLINE void sb_printf5(sb *s, char *fmt, char *a1, char *a2, char *a3, char *a4, char *a5)
+SB_API SB_INLINE void sb_pool_cache_init(sb_pool_cache *c, sb_pool *p)
 {
-  void *args[5];
-  args[0] = a1;
-  args[1] = a2;
-  args[2] = a3;
-  args[3] = a4;
-  args[4] = a5;
-  sb_printf(s, fmt, args, 5);
+  c->pool = p;
+  c->n = 0;
 }
 
-SB_API SB_INLINE void sb_printf6(sb *s, char *fmt, char *a1, char *a2, char *a3, char *a4, char *a5, char *a6)
+/* Starts a builder on a free buffer, refilling the cache from the pool when it is empty.
+ * Returns 0, or -1 if every buffer is in use.
+ */
+SB_API SB_INLINE int sb_pool_acquire(sb_pool_cache *c, sb *sb)
 {
-  void *args[6];
-  args[0] = a1;
-  args[1] = a2;
-  args[2] = a3;
-  args[3] = a4;
-  args[4] = a5;
-  args[5] = a6;
-  sb_printf(s, fmt, args, 6);
+  sb_pool *p = c->pool;
+  int i;
+
+  while (c->n < SB_POOL_CACHE / 2)
+  {
+    i = sb_pool_pop(p);
+
+    if (i < 0)
+    {
+      break;
+    }
+
+    c->items[c->n++] = i;
+  }
+
+  if (c->n == 0)
+  {
+    return -1;
+  }
+
+  i = c->items[--c->n];
+  sb_init(sb, p->mem + (sb_size)i * p->size, p->size);
+
+  return 0;
 }
 
-SB_API SB_INLINE void sb_printf7(sb *s, char *fmt, char *a1, char *a2, char *a3, char *a4, char *a5, char *a6, char *a7)
+/* Returns the builder's buffer to the cache, spilling half of a full cache to the pool */
+SB_API SB_INLINE void sb_pool_release(sb_pool_cache *c, sb *sb)
 {
-  void *args[7];
-  args[0] = a1;
-  args[1] = a2;
-  args[2] = a3;
-  args[3] = a4;
-  args[4] = a5;
-  args[5] = a6;
-  args[6] = a7;
-  sb_printf(s, fmt, args, 7);
+  sb_pool *p = c->pool;
+
+  if (c->n == SB_POOL_CACHE)
+  {
+    while (c->n > SB_POOL_CACHE / 2)
+    {
+      sb_pool_push(p, c->items[--c->n]);
+    }
+  }
+
+  c->items[c->n++] = (int)((sb->buf - p->mem) / p->size);
+  sb->buf = 0;
+  sb->cap = 0;
+  sb->len = 0;
 }
 
-SB_API SB_INLINE void sb_printf8(sb *s, char *fmt, char *a1, char *a2, char *a3, char *a4, char *a5, char *a6, char *a7, char *a8)
+/* Returns all cached buffers to the pool (call it before the owning thread exits) */
+SB_API SB_INLINE void sb_pool_cache_flush(sb_pool_cache *c)
 {
-  void *args[8];
-  args[0] = a1;
-  args[1] = a2;
-  args[2] = a3;
-  args[3] = a4;
-  args[4] = a5;
-  args[5] = a6;
-  args[6] = a7;
-  args[7] = a8;
-  sb_printf(s, fmt, args, 8);
+  while (c->n > 0)
+  {
+    sb_pool_push(c->pool, c->items[--c->n]);
+  }
+}
+#endif
+
+/* #############################################################################
+ * # PARALLEL FORMATTING
+ * #############################################################################
+ */
+#ifdef SB_LINUX_SYSCALLS
+#ifndef SB_PARALLEL_MAX_THREADS
+#define SB_PARALLEL_MAX_THREADS 64
+#endif
+
+/* Formats row index into sb with any sb_append_*. Has to produce the same bytes on every call. */
+typedef void (*sb_row_format)(sb *sb, int row, void *ctx);
+
+/* Barrier between the measure and the format pass, shared by all chunks of one call */
+typedef struct sb_parallel_sync
+{
+  unsigned int pending; /* Workers still measuring (futex) */
+  unsigned int phase;   /* 0 measuring, 1 format, 2 abort (futex) */
+
+} sb_parallel_sync;
+
+typedef struct sb_parallel_chunk
+{
+  sb_row_format format;
+  void *ctx;
+  sb_parallel_sync *sync;
+  int lo;           /* First row */
+  int hi;           /* One past the last row */
+  char *dst;        /* Final position in the output, 0 while measuring */
+  sb_size len;      /* Measured length, the exact space at dst */
+  int ok;           /* Format pass produced exactly the measured length */
+  int started;      /* Runs on its own thread */
+  sb_thread thread;
+
+} sb_parallel_chunk;
+
+/* One pass over the rows of a chunk, measuring (dst == 0) or formatting in place */
+SB_API SB_INLINE void sb_parallel_run(sb_parallel_chunk *c)
+{
+  sb s;
+  int i;
+
+  /* A builder without capacity only counts, which is the measure mode of every formatter */
+  sb_init(&s, c->dst, c->dst ? c->len : 0);
+
+  for (i = c->lo; i < c->hi; ++i)
+  {
+    c->format(&s, i, c->ctx);
+  }
+
+  if (c->dst)
+  {
+    c->ok = (s.len == c->len);
+  }
+  else
+  {
+    c->len = s.len;
+  }
+}
+
+/* Worker thread: measures, waits at the barrier for its offset, then formats in place */
+SB_API SB_INLINE void sb_parallel_worker(void *arg)
+{
+  sb_parallel_chunk *c = (sb_parallel_chunk *)arg;
+  sb_parallel_sync *sync = c->sync;
+  unsigned int phase;
+
+  sb_parallel_run(c);
+
+  if (__atomic_sub_fetch(&sync->pending, 1u, __ATOMIC_ACQ_REL) == 0)
+  {
+    sb_futex_wake(&sync->pending);
+  }
+
+  while ((phase = __atomic_load_n(&sync->phase, __ATOMIC_ACQUIRE)) == 0)
+  {
+    sb_futex_wait(&sync->phase, 0);
+  }
+
+  if (phase == 1)
+  {
+    sb_parallel_run(c);
+  }
+}
+
+/* Appends format(row) for all rows. Every chunk is measured, a prefix sum over the lengths places the
+ * chunks, then every chunk is formatted straight into its final position in sb, there is no
+ * concatenation copy. The work is split over up to threads threads started through shim, one set of
+ * workers serves both passes. Without a shim everything runs on the caller: raw threads share the
+ * caller's TLS, so pass &SB_THREAD_SHIM_RAW only if format never calls into libc and needs little
+ * stack (SB_THREAD_STACK). If the output does not fit nothing is written, len grows by the required
+ * size and ovr is set. Returns 0, or -1 on overflow or if format was not deterministic.
+ */
+SB_API SB_INLINE int sb_append_parallel(sb *sb, int rows, sb_row_format format, void *ctx, int threads, sb_thread_shim *shim)
+{
+  sb_parallel_chunk chunks[SB_PARALLEL_MAX_THREADS];
+  sb_parallel_sync sync;
+  sb_size total = 0;
+  sb_size off;
+  unsigned int pending;
+  int ok = 1;
+  int n;
+  int k;
+
+  if (rows <= 0)
+  {
+    return 0;
+  }
+
+  n = (threads < 1 || !shim) ? 1 : (threads > SB_PARALLEL_MAX_THREADS ? SB_PARALLEL_MAX_THREADS : threads);
+  n = (n > rows) ? rows : n;
+  sync.pending = 0;
+  sync.phase = 0;
+
+  for (k = 0; k < n; ++k)
+  {
+    chunks[k].format = format;
+    chunks[k].ctx = ctx;
+    chunks[k].sync = &sync;
+    chunks[k].lo = (int)((sb_i64)rows * k / n);
+    chunks[k].hi = (int)((sb_i64)rows * (k + 1) / n);
+    chunks[k].dst = 0;
+    chunks[k].len = 0;
+    chunks[k].ok = 1;
+    chunks[k].started = 0;
+  }
+
+  /* Measure pass: chunk 0 and any chunk whose thread did not start run on the caller */
+  for (k = 1; k < n; ++k)
+  {
+    __atomic_add_fetch(&sync.pending, 1u, __ATOMIC_RELAXED);
+    chunks[k].started = sb_thread_start(&chunks[k].thread, shim, sb_parallel_worker, &chunks[k]) == 0;
+
+    if (!chunks[k].started)
+    {
+      __atomic_sub_fetch(&sync.pending, 1u, __ATOMIC_RELAXED);
+      sb_parallel_run(&chunks[k]);
+    }
+  }
+
+  sb_parallel_run(&chunks[0]);
+
+  while ((pending = __atomic_load_n(&sync.pending, __ATOMIC_ACQUIRE)) != 0)
+  {
+    sb_futex_wait(&sync.pending, pending);
+  }
+
+  for (k = 0; k < n; ++k)
+  {
+    total = (chunks[k].len > SB_SIZE_MAX - total) ? SB_SIZE_MAX : total + chunks[k].len;
+  }
+
+  if (sb->len > sb->cap || total > sb->cap - sb->len)
+  {
+    sb->len = (total > SB_SIZE_MAX - sb->len) ? SB_SIZE_MAX : sb->len + total;
+    sb->ovr = 1;
+    ok = 0;
+  }
+  else
+  {
+    /* Prefix sum gives every chunk its final position */
+    off = sb->len;
+
+    for (k = 0; k < n; ++k)
+    {
+      chunks[k].dst = sb->buf + off;
+      off += chunks[k].len;
+    }
+  }
+
+  /* Release the workers into the format pass (or let them exit) */
+  __atomic_store_n(&sync.phase, ok ? 1u : 2u, __ATOMIC_RELEASE);
+  sb_futex_wake(&sync.phase);
+
+  if (ok)
+  {
+    sb_parallel_run(&chunks[0]);
+
+    for (k = 1; k < n; ++k)
+    {
+      if (!chunks[k].started)
+      {
+        sb_parallel_run(&chunks[k]);
+      }
+    }
+  }
+
+  for (k = 1; k < n; ++k)
+  {
+    sb_thread_join(&chunks[k].thread);
+  }
+
+  if (!ok)
+  {
+    return -1;
+  }
+
+  for (k = 0; k < n; ++k)
+  {
+    ok &= chunks[k].ok;
+  }
+
+  sb->len += total;
+
+  return ok ? 0 : -1;
+}
+#endif
+
+/* #############################################################################
+ * # SNAPSHOTS
+ * #############################################################################
+ */
+#if defined(__GNUC__) || defined(__clang__)
+/* Double buffered snapshot: one writer formats into the back buffer and publishes it with a
+ * sequence counter (seqlock), any number of readers get a consistent view without locking.
+ */
+typedef struct sb_snapshot
+{
+  char *bufs[2];     /* Front and back buffer */
+  sb_size cap;       /* Size of each buffer */
+  int back;          /* Buffer the writer formats into next (writer owned) */
+  unsigned long seq; /* Odd while a publish is in progress */
+  char *ptr;         /* Published content, guarded by seq */
+  sb_size len;       /* Published length, guarded by seq */
+
+} sb_snapshot;
+
+/* Splits mem into the two buffers, the published snapshot starts out empty */
+SB_API SB_INLINE void sb_snapshot_init(sb_snapshot *s, char *mem, sb_size mem_size)
+{
+  s->cap = (mem_size > 0) ? mem_size / 2 : 0;
+  s->bufs[0] = mem;
+  s->bufs[1] = mem + s->cap;
+  s->back = 1;
+  s->seq = 0;
+  s->ptr = s->bufs[0];
+  s->len = 0;
+}
+
+/* Writer: starts a builder on the back buffer, use any sb_append_* on it afterwards */
+SB_API SB_INLINE void sb_snapshot_begin(sb_snapshot *s, sb *sb)
+{
+  /* Readers still copying this buffer must see the sequence change before any of the new bytes */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  sb_init(sb, s->bufs[s->back], s->cap);
+}
+
+/* Writer: publishes the builder's stored bytes and swaps the buffers */
+SB_API SB_INLINE void sb_snapshot_publish(sb_snapshot *s, sb *sb)
+{
+  unsigned long seq = s->seq;
+
+  __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&s->ptr, sb->buf, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->len, (sb->len < sb->cap) ? sb->len : sb->cap, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+
+  s->back ^= 1;
+}
+
+/* Reader: returns the sequence the view belongs to, waiting out a publish in progress */
+SB_API SB_INLINE unsigned long sb_snapshot_read_begin(sb_snapshot *s, sb_view *v)
+{
+  unsigned long seq;
+
+  while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+  {
+    /* A publish is only a few stores long, spin */
+  }
+
+  v->ptr = __atomic_load_n(&s->ptr, __ATOMIC_RELAXED);
+  v->len = __atomic_load_n(&s->len, __ATOMIC_RELAXED);
+
+  return seq;
+}
+
+/* Reader: 1 if the writer swapped buffers since sb_snapshot_read_begin, everything read from the
+ * view has to be discarded then. The view is only stable until the next swap.
+ */
+SB_API SB_INLINE int sb_snapshot_read_retry(sb_snapshot *s, unsigned long seq)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/* Reader: copies a consistent snapshot (at most cap bytes) to dst. Returns its full length. */
+SB_API SB_INLINE sb_size sb_snapshot_copy(sb_snapshot *s, char *dst, sb_size cap)
+{
+  sb_view v;
+  unsigned long seq;
+  sb_size i;
+
+  do
+  {
+    seq = sb_snapshot_read_begin(s, &v);
+
+    for (i = 0; i < v.len && i < cap; ++i)
+    {
+      dst[i] = v.ptr[i];
+    }
+  } while (sb_snapshot_read_retry(s, seq));
+
+  return v.len;
 }
+#endif
 
 #endif /* SB_H */
 
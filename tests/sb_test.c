@@ -174,6 +174,1668 @@ void sb_test_printf(void)
   assert(sb_cmp(&s, "\"Name:        Foo Score:         42 PI: 3.1416\"\n") == 0);
 }
 
+void sb_test_append_hex_oct_bin(void)
+{
+  char buf[64];
+  char small[8];
+  unsigned long v = 255ul;
+  sb s;
+  sb_init(&s, buf, sizeof(buf));
+
+  sb_append_hex(&s, 0xdeadbeeful, 0, SB_PAD_NONE, SB_CASE_LOWER);
+  assert(sb_cmp(&s, "deadbeef") == 0);
+
+  s.len = 0;
+  sb_append_hex(&s, SB_U64(0x0123ABCDul, 0xEF456789ul), 0, SB_PAD_NONE, SB_CASE_UPPER);
+  assert(sb_cmp(&s, "123ABCDEF456789") == 0);
+
+  s.len = 0;
+  sb_append_hex(&s, 0, 4, SB_PAD_LEFT, SB_CASE_LOWER);
+  assert(sb_cmp(&s, "   0") == 0);
+
+  s.len = 0;
+  sb_append_hex_fixed(&s, SB_U64(0x00000000ul, 0x00c0ffeeul), 16, SB_CASE_LOWER);
+  assert(sb_cmp(&s, "0000000000c0ffee") == 0);
+
+  s.len = 0;
+  sb_append_hex_fixed(&s, 0xabul, 4, SB_CASE_UPPER);
+  assert(sb_cmp(&s, "00AB") == 0);
+
+  s.len = 0;
+  sb_append_oct(&s, 0755ul, 0, SB_PAD_NONE);
+  assert(sb_cmp(&s, "755") == 0);
+
+  s.len = 0;
+  sb_append_oct(&s, SB_U64(0xFFFFFFFFul, 0xFFFFFFFFul), 0, SB_PAD_NONE);
+  assert(sb_cmp(&s, "1777777777777777777777") == 0);
+
+  s.len = 0;
+  sb_append_bin(&s, 10ul, 6, SB_PAD_LEFT);
+  assert(sb_cmp(&s, "  1010") == 0);
+
+  s.len = 0;
+  sb_append_bin(&s, 0ul, 0, SB_PAD_NONE);
+  assert(sb_cmp(&s, "0") == 0);
+
+  s.len = 0;
+  sb_printf2(&s, "%x %-4X", (char *)&v, (char *)&v);
+  assert(sb_cmp(&s, "ff   FF") == 0);
+
+  /* Overflow keeps counting and stores the digits that fit */
+  sb_init(&s, small, sizeof(small));
+  sb_append_hex_fixed(&s, SB_U64(0x01234567ul, 0x89abcdeful), 16, SB_CASE_LOWER);
+  assert(s.ovr == 1 && s.len == 16);
+  sb_term(&s);
+  assert(sb_cmp(&s, "0123456") == 0);
+}
+
+void sb_test_append_hex_bytes_hexdump(void)
+{
+  char data[40];
+  char buf[512];
+  char small[10];
+  sb s;
+  int i;
+
+  for (i = 0; i < (int)sizeof(data); ++i)
+  {
+    data[i] = (char)(i * 7 + 0x30);
+  }
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_hex_bytes(&s, "\x01\xab\xff", 3, SB_CASE_LOWER);
+  assert(sb_cmp(&s, "01abff") == 0);
+
+  /* Long enough for the SIMD kernel plus a scalar tail */
+  s.len = 0;
+  assert(sb_append_hex_bytes(&s, data, 20, SB_CASE_UPPER) == 40);
+  assert(s.len == 40);
+  assert(sb_ncmp(&s, "30373E454C535A61686F767D848B9299A0A7AEB5", 40) == 0);
+
+  sb_init(&s, small, sizeof(small));
+  assert(sb_append_hex_bytes(&s, data, 8, SB_CASE_LOWER) == 16);
+  assert(s.ovr == 1 && s.len == 16);
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_hexdump(&s, "Hello World, this is sb!\n", 25, 0x100);
+  sb_term(&s);
+  test_print_string(s.buf);
+  assert(sb_cmp(&s,
+                "00000100  48 65 6c 6c 6f 20 57 6f  72 6c 64 2c 20 74 68 69  |Hello World, thi|\n"
+                "00000110  73 20 69 73 20 73 62 21  0a                       |s is sb!.|\n") == 0);
+
+  /* Near capacity the lines go through the overflow checked path */
+  sb_init(&s, small, sizeof(small));
+  sb_append_hexdump(&s, data, 3, 0);
+  assert(s.ovr == 1 && s.len == 8 + 2 + 48 + 1 + 2 + 3 + 2);
+}
+
+void sb_test_base64(void)
+{
+  char data[100];
+  char buf[256];
+  char dec[256];
+  char small[6];
+  sb s;
+  sb d;
+  int i;
+  int n;
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_base64(&s, "Man", 3);
+  sb_append_base64(&s, "Ma", 2);
+  sb_append_base64(&s, "M", 1);
+  assert(sb_cmp(&s, "TWFuTWE=TQ==") == 0);
+
+  s.len = 0;
+  sb_append_base64url(&s, "\xfb\xff\xbf", 3);
+  sb_append_base64url(&s, "\xfb\xff", 2);
+  assert(sb_cmp(&s, "-_-_-_8") == 0);
+
+  /* Round trip through the SIMD kernels and scalar tails */
+  for (i = 0; i < (int)sizeof(data); ++i)
+  {
+    data[i] = (char)(i * 37 + 11);
+  }
+
+  for (n = 0; n <= (int)sizeof(data); n += 7)
+  {
+    s.len = 0;
+    sb_append_base64(&s, data, n);
+    assert(s.len == sb_base64_encoded_len(n, 0));
+
+    sb_init(&d, dec, sizeof(dec));
+    assert(sb_append_base64_decoded(&d, s.buf, (int)s.len) == n);
+
+    for (i = 0; i < n; ++i)
+    {
+      assert(dec[i] == data[i]);
+    }
+
+    s.len = 0;
+    sb_append_base64url(&s, data, n);
+    sb_init(&d, dec, sizeof(dec));
+    assert(sb_append_base64_decoded(&d, s.buf, (int)s.len) == n);
+    assert(d.len == n && (n == 0 || dec[n - 1] == data[n - 1]));
+  }
+
+  sb_init(&d, dec, sizeof(dec));
+  assert(sb_append_base64_decoded(&d, "TWFu*WE=", 8) == -1);
+  assert(sb_append_base64_decoded(&d, "TWFuT", 5) == -1);
+  assert(d.len == 0);
+
+  /* Near capacity: overflow is flagged and the length keeps counting */
+  sb_init(&s, small, sizeof(small));
+  assert(sb_append_base64(&s, "Hello World", 11) == 16);
+  assert(s.ovr == 1 && s.len == 16 && small[0] == 'S');
+}
+
+void sb_test_json(void)
+{
+  char buf[512];
+  char small[16];
+  sb s;
+  sb_json j;
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_json_init(&j, &s);
+
+  sb_json_object_begin(&j);
+  sb_json_key(&j, "name");
+  sb_json_string(&j, "sb \"json\"\n");
+  sb_json_key(&j, "values");
+  sb_json_array_begin(&j);
+  sb_json_long(&j, -42);
+  sb_json_ulong(&j, 7);
+  sb_json_double(&j, 3.25, 2);
+  sb_json_bool(&j, 1);
+  sb_json_null(&j);
+  sb_json_object_begin(&j);
+  sb_json_object_end(&j);
+  sb_json_array_end(&j);
+  sb_json_key(&j, "long");
+  sb_json_string(&j, "The quick brown fox \\ jumps over the lazy dog\t\x01 and again past the SIMD block size.");
+  sb_json_object_end(&j);
+  sb_term(&s);
+
+  test_print_string(s.buf);
+  test_print_string("\n");
+  assert(j.err == 0 && j.depth == 0);
+  assert(sb_cmp(&s, "{\"name\":\"sb \\\"json\\\"\\n\",\"values\":[-42,7,3.25,true,null,{}],"
+                    "\"long\":\"The quick brown fox \\\\ jumps over the lazy dog\\t\\u0001 and again past the SIMD block size.\"}") == 0);
+
+  /* Nesting misuse is reported through the error flag */
+  sb_init(&s, buf, sizeof(buf));
+  sb_json_init(&j, &s);
+  sb_json_array_begin(&j);
+  sb_json_key(&j, "x");
+  assert(j.err == 1);
+
+  /* A value inside an object without a key is misuse too */
+  sb_init(&s, buf, sizeof(buf));
+  sb_json_init(&j, &s);
+  sb_json_object_begin(&j);
+  sb_json_long(&j, 1);
+  assert(j.err == 1);
+
+  sb_json_init(&j, &s);
+  sb_json_object_begin(&j);
+  sb_json_key(&j, "a");
+  sb_json_long(&j, 1);
+  sb_json_array_begin(&j);
+  assert(j.err == 1);
+
+  /* Near capacity the escaper goes through the overflow checked path */
+  sb_init(&s, small, sizeof(small));
+  sb_append_json_escaped(&s, "a\"b\\c\x1f" "defghijklmnop", 19);
+  assert(s.ovr == 1 && s.len == 26);
+  sb_term(&s);
+  assert(sb_cmp(&s, "a\\\"b\\\\c\\u001fde") == 0);
+}
+
+void sb_test_csv(void)
+{
+  char buf[256];
+  char small[8];
+  sb s;
+  sb_csv c;
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_csv_init(&c, &s, ',', "\r\n");
+
+  sb_csv_field(&c, "id");
+  sb_csv_field(&c, "name");
+  sb_csv_field(&c, "score");
+  sb_csv_end_record(&c);
+
+  sb_csv_long(&c, -1);
+  sb_csv_field(&c, "Smith, \"Agent\" with a long name");
+  sb_csv_double(&c, 0.5, 1);
+  sb_csv_end_record(&c);
+  sb_term(&s);
+
+  assert(sb_cmp(&s, "id,name,score\r\n-1,\"Smith, \"\"Agent\"\" with a long name\",0.5\r\n") == 0);
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_csv_init(&c, &s, '\t', "\n");
+  sb_csv_field(&c, "a,b");
+  sb_csv_field(&c, "line\nbreak");
+  sb_csv_ulong(&c, 3);
+  sb_csv_end_record(&c);
+  sb_term(&s);
+
+  assert(sb_cmp(&s, "a,b\t\"line\nbreak\"\t3\n") == 0);
+
+  /* Near capacity: quoting goes through the overflow checked path */
+  sb_init(&s, small, sizeof(small));
+  sb_append_csv_quoted(&s, "x\"y\"", 4);
+  assert(s.ovr == 0 && s.len == 8);
+  sb_term(&s);
+  assert(s.ovr == 1);
+  assert(sb_cmp(&s, "\"x\"\"y\"\"") == 0);
+}
+
+void sb_test_html_xml_url_escaping(void)
+{
+  char buf[256];
+  char url[64] = "a%20b%2Fc%7e%C3%A4+d";
+  char bad[8] = "ab%2";
+  sb s;
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_html_escaped(&s, "<td class=\"name\">Tom & Jerry's table cell</td>", 46);
+  assert(sb_cmp(&s, "&lt;td class=&quot;name&quot;&gt;Tom &amp; Jerry&#39;s table cell&lt;/td&gt;") == 0);
+
+  s.len = 0;
+  sb_append_xml_escaped(&s, "'a'<b>", 6);
+  assert(sb_cmp(&s, "&apos;a&apos;&lt;b&gt;") == 0);
+
+  s.len = 0;
+  sb_append_url_encoded(&s, "a b/c~\xc3\xa4-_.", 11);
+  assert(sb_cmp(&s, "a%20b%2Fc~%C3%A4-_.") == 0);
+
+  assert(sb_url_decode_inplace(url, 20) == 10);
+  assert(url[0] == 'a' && url[1] == ' ' && url[3] == '/' && url[5] == '~');
+  assert((unsigned char)url[6] == 0xc3 && (unsigned char)url[7] == 0xa4 && url[8] == '+' && url[9] == 'd');
+
+  assert(sb_url_decode_inplace(bad, 4) == -1);
+  assert(sb_url_decode_inplace("%zz", 3) == -1);
+}
+
+void sb_test_utf8(void)
+{
+  /* "Grüße, 世界! ..." mixes 1, 2 and 3 byte sequences across 16 byte blocks */
+  char *text = "Gr\xc3\xbc\xc3\x9f" "e, \xe4\xb8\x96\xe7\x95\x8c! \xf0\x9f\x98\x80 plain ASCII tail to cross blocks";
+  char buf[128];
+  int n = 0;
+  sb s;
+
+  while (text[n] != '\0')
+  {
+    n++;
+  }
+
+  assert(sb_utf8_validate(text, n) == 1);
+  assert(sb_utf8_validate("\xc3", 1) == 0);                 /* truncated */
+  assert(sb_utf8_validate("\xc0\xaf", 2) == 0);             /* overlong */
+  assert(sb_utf8_validate("\xed\xa0\x80", 3) == 0);         /* surrogate */
+  assert(sb_utf8_validate("\xf4\x90\x80\x80", 4) == 0);     /* above U+10FFFF */
+  assert(sb_utf8_validate("0123456789abcde\xe4\xb8", 17) == 0); /* truncated at block end */
+
+  assert(sb_utf8_count(text, n) == n - 2 - 4 - 3);
+  assert(sb_text_width("\xe4\xb8\x96\xe7\x95\x8c", 6, SB_WIDTH_BYTES) == 6);
+  assert(sb_text_width("\xe4\xb8\x96\xe7\x95\x8c", 6, SB_WIDTH_CODEPOINTS) == 2);
+  assert(sb_text_width("\xe4\xb8\x96\xe7\x95\x8c", 6, SB_WIDTH_COLUMNS) == 4);
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_cstr_padded_width(&s, "Gr\xc3\xbc\xc3\x9f" "e", 8, SB_PAD_RIGHT, SB_WIDTH_CODEPOINTS);
+  sb_append_cstr(&s, "|");
+  assert(sb_cmp(&s, "Gr\xc3\xbc\xc3\x9f" "e   |") == 0);
+
+  s.len = 0;
+  sb_printf1(&s, "%-6S|", "\xe4\xb8\x96\xe7\x95\x8c");
+  assert(sb_cmp(&s, "  \xe4\xb8\x96\xe7\x95\x8c|") == 0);
+}
+
+void sb_test_utf16(void)
+{
+  /* "Hello, wide world: ä€😀" + unpaired high surrogate */
+  unsigned short wide[] = {'H', 'e', 'l', 'l', 'o', ',', ' ', 'w', 'i', 'd', 'e', ' ', 'w', 'o', 'r', 'l', 'd', ':', ' ',
+                           0x00e4, 0x20ac, 0xd83d, 0xde00, 0xd800};
+  unsigned short back[32];
+  char buf[64];
+  char small[8];
+  sb s;
+  int n = (int)(sizeof(wide) / sizeof(wide[0]));
+  int i;
+
+  sb_init(&s, buf, sizeof(buf));
+  assert(sb_append_utf16(&s, wide, n) == 19 + 2 + 3 + 4 + 3);
+  assert(sb_cmp(&s, "Hello, wide world: \xc3\xa4\xe2\x82\xac\xf0\x9f\x98\x80\xef\xbf\xbd") == 0);
+  sb_term(&s);
+
+  /* Round trip, the unpaired surrogate comes back as U+FFFD */
+  assert(sb_to_utf16(&s, back, 32) == n);
+  for (i = 0; i < n - 1; ++i)
+  {
+    assert(back[i] == wide[i]);
+  }
+  assert(back[n - 1] == 0xfffd && back[n] == 0);
+
+  /* Invalid UTF-8 bytes are replaced, too small destinations still report the needed size */
+  assert(sb_utf8_to_utf16("a\xff" "b", 3, back, 32) == 3 && back[1] == 0xfffd);
+  assert(sb_utf8_to_utf16("abc", 3, back, 2) == 3);
+
+  sb_init(&s, small, sizeof(small));
+  assert(sb_append_utf16(&s, wide, n) == 31);
+  assert(s.ovr == 1);
+}
+
+void sb_test_truncation(void)
+{
+  char big[SB_TRUNC_LINE_WINDOW + 50];
+  char buf[12];
+  sb s;
+
+  /* Default: cut at cap - 1, may split the UTF-8 sequence of "ä" */
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_cstr(&s, "0123456789\xc3\xa4");
+  sb_term(&s);
+  assert(s.ovr == 1 && s.len == 11 && (unsigned char)buf[10] == 0xc3);
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_set_truncation(&s, SB_TRUNC_UTF8, 0);
+  sb_append_cstr(&s, "0123456789\xc3\xa4");
+  sb_term(&s);
+  assert(s.ovr == 1 && sb_cmp(&s, "0123456789") == 0);
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_cstr(&s, "first\nsecond line");
+  sb_term_truncate(&s, SB_TRUNC_LINE, 0);
+  assert(s.ovr == 1 && sb_cmp(&s, "first\n") == 0);
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_cstr(&s, "a long log message");
+  sb_term_truncate(&s, SB_TRUNC_MARKER, 0);
+  assert(s.ovr == 1 && sb_cmp(&s, "a long l...") == 0);
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_cstr(&s, "abcdefg\xe2\x82\xac\xe2\x82\xac");
+  sb_term_truncate(&s, SB_TRUNC_MARKER | SB_TRUNC_UTF8, "~");
+  assert(sb_cmp(&s, "abcdefg\xe2\x82\xac~") == 0);
+
+  /* One long line: the newline lies outside SB_TRUNC_LINE_WINDOW, the marker policy applies instead */
+  sb_init(&s, big, sizeof(big));
+  sb_append_cstr(&s, "head\n");
+  sb_append_spaces(&s, SB_TRUNC_LINE_WINDOW + 100);
+  sb_term_truncate(&s, SB_TRUNC_LINE | SB_TRUNC_MARKER, 0);
+  assert(s.ovr == 1 && s.len == (sb_size)sizeof(big) - 1 && big[s.len - 1] == '.' && big[4] == '\n');
+
+  sb_init(&s, big, sizeof(big));
+  sb_append_spaces(&s, SB_TRUNC_LINE_WINDOW / 2);
+  sb_putc(&s, '\n');
+  sb_append_spaces(&s, SB_TRUNC_LINE_WINDOW);
+  sb_term_truncate(&s, SB_TRUNC_LINE, 0);
+  assert(s.len == SB_TRUNC_LINE_WINDOW / 2 + 1);
+
+  /* No overflow, the policy does not touch the content */
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_cstr(&s, "short");
+  sb_term_truncate(&s, SB_TRUNC_MARKER | SB_TRUNC_LINE, 0);
+  assert(s.ovr == 0 && sb_cmp(&s, "short") == 0);
+}
+
+void sb_test_arena(void)
+{
+  char mem[32];
+  sb_arena a;
+  sb_view v1;
+  sb_view v2;
+  sb_view v3;
+  sb s;
+
+  sb_arena_init(&a, mem, sizeof(mem));
+
+  sb_arena_begin(&a, &s);
+  sb_append_cstr(&s, "key:");
+  sb_append_ulong(&s, 42, 0, SB_PAD_NONE);
+  v1 = sb_arena_end(&a, &s);
+
+  sb_arena_begin(&a, &s);
+  sb_append_hex(&s, 0xbeeful, 0, SB_PAD_NONE, SB_CASE_LOWER);
+  v2 = sb_arena_end(&a, &s);
+
+  /* Both strings live contiguously in the arena and stay valid */
+  assert(v1.ptr == mem && v1.len == 6 && v1.ptr[6] == '\0');
+  assert(v2.ptr == mem + 7 && v2.len == 4 && v2.ptr[0] == 'b');
+  assert(a.used == 12);
+
+  sb_arena_begin(&a, &s);
+  sb_append_cstr(&s, "this label is too long for the rest");
+  v3 = sb_arena_end(&a, &s);
+  assert(v3.ptr == 0 && a.ovr == 1 && a.used == 12);
+
+  sb_arena_reset(&a);
+  sb_arena_begin(&a, &s);
+  sb_append_cstr(&s, "again");
+  v3 = sb_arena_end(&a, &s);
+  assert(v3.ptr == mem && v3.len == 5 && a.ovr == 0);
+}
+
+void sb_test_intern(void)
+{
+  char mem[64];
+  sb_intern_slot slots[8];
+  sb_arena a;
+  sb_intern t;
+  sb_view v1;
+  sb_view v2;
+  sb_view v3;
+  sb s;
+  sb_size used;
+
+  sb_arena_init(&a, mem, sizeof(mem));
+  assert(sb_intern_init(&t, slots, 8, &a) == 0);
+
+  sb_arena_begin(&a, &s);
+  sb_append_cstr(&s, "host=");
+  sb_append_ulong(&s, 7, 0, SB_PAD_NONE);
+  v1 = sb_intern_end(&t, &s);
+  used = a.used;
+
+  /* The duplicate is dropped from the arena tail and the canonical view is returned */
+  sb_arena_begin(&a, &s);
+  sb_append_cstr(&s, "host=7");
+  v2 = sb_intern_end(&t, &s);
+  assert(v2.ptr == v1.ptr && v2.len == 6 && a.used == used && t.count == 1);
+
+  /* Strings built elsewhere are copied once */
+  v3 = sb_intern_bytes(&t, "host=8", 6);
+  assert(v3.ptr != v1.ptr && v3.ptr == mem + used && t.count == 2);
+  assert(sb_intern_bytes(&t, "host=8", 6).ptr == v3.ptr && a.used == used + 7);
+
+  /* The table refuses to go beyond 3/4 load */
+  sb_intern_bytes(&t, "a", 1);
+  sb_intern_bytes(&t, "b", 1);
+  sb_intern_bytes(&t, "c", 1);
+  sb_intern_bytes(&t, "d", 1);
+  assert(t.count == 6 && t.ovr == 0);
+  assert(sb_intern_bytes(&t, "e", 1).ptr == 0 && t.ovr == 1);
+  assert(sb_intern_bytes(&t, "c", 1).ptr != 0);
+
+  /* Bad slot counts are rejected, the table refuses every string */
+  assert(sb_intern_init(&t, slots, 0, &a) == -1 && t.ovr == 1);
+  assert(sb_intern_bytes(&t, "c", 1).ptr == 0);
+  assert(sb_intern_init(&t, slots, 6, &a) == -1);
+  assert(sb_intern_init(&t, slots, -8, &a) == -1);
+  assert(sb_intern_init(&t, 0, 8, &a) == -1);
+  sb_arena_begin(&a, &s);
+  sb_append_cstr(&s, "x");
+  assert(sb_intern_end(&t, &s).ptr == 0);
+}
+
+void sb_test_hash(void)
+{
+  char buf[256];
+  sb s;
+  sb_hash_state st;
+  sb_view v;
+  int n;
+
+  /* Incremental hashing while appending matches the one shot hash for every length */
+  for (n = 0; n <= 200; n += 13)
+  {
+    int i;
+
+    sb_init(&s, buf, sizeof(buf));
+    sb_hash_init(&st, 0);
+
+    for (i = 0; i < n; ++i)
+    {
+      sb_putc(&s, (char)('a' + i % 26));
+      sb_hash_update(&st, &s);
+    }
+
+    assert(sb_hash_final(&st, &s) == sb_hash64(&s));
+  }
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_cstr(&s, "shard-key-1");
+  v.ptr = "shard-key-1";
+  v.len = 11;
+  assert(sb_hash64(&s) == sb_hash64_str(v));
+
+  v.ptr = "shard-key-2";
+  assert(sb_hash64(&s) != sb_hash64_str(v));
+  assert(sb_hash64_bytes("", 0, 0) != sb_hash64_bytes("", 0, 1));
+  assert(sb_hash64_bytes("a", 1, 0) != sb_hash64_bytes("b", 1, 0));
+}
+
+void sb_test_crc32c(void)
+{
+  char buf[128];
+  sb s;
+  unsigned int crc;
+  int i;
+
+  assert(sb_crc32c_bytes(0, "123456789", 9) == 0xe3069283u);
+  assert(sb_crc32c_bytes(sb_crc32c_bytes(0, "1234", 4), "56789", 5) == 0xe3069283u);
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_cstr(&s, "hdr:");
+
+  for (i = 0; i < 40; ++i)
+  {
+    sb_putc(&s, (char)i);
+  }
+
+  assert(sb_crc32c(&s, 4, s.len) == sb_crc32c_bytes(0, buf + 4, 40));
+
+  crc = sb_append_crc32c(&s, 4);
+  assert(s.len == 48);
+  assert((unsigned char)buf[44] == (crc & 0xffu) && (unsigned char)buf[47] == (crc >> 24));
+  assert(sb_crc32c(&s, 10, 5) == 0);
+}
+
+void sb_test_backpatch(void)
+{
+  char buf[64];
+  sb s;
+  sb_slot len4;
+  sb_slot var;
+  sb_slot dec;
+  sb_slot hex;
+
+  sb_init(&s, buf, sizeof(buf));
+  len4 = sb_reserve_slot(&s, 4);
+  sb_append_cstr(&s, "payload");
+  assert(sb_slot_len(&s, len4) == 7);
+  assert(sb_patch_u32le(&s, len4, (unsigned long)sb_slot_len(&s, len4)));
+  assert(buf[0] == 7 && buf[1] == 0 && buf[2] == 0 && buf[3] == 0 && buf[4] == 'p');
+
+  s.len = 0;
+  var = sb_reserve_slot(&s, 2);
+  assert(sb_patch_varint(&s, var, 5));
+  assert((unsigned char)buf[0] == 0x85 && buf[1] == 0x00);
+  assert(sb_patch_varint(&s, var, 300));
+  assert((unsigned char)buf[0] == 0xac && buf[1] == 0x02);
+  assert(!sb_patch_varint(&s, var, 16384));
+
+  s.len = 0;
+  sb_append_cstr(&s, "Content-Length:");
+  dec = sb_reserve_slot(&s, 4);
+  sb_append_cstr(&s, "\r\n\r\nhello");
+  assert(sb_patch_decimal(&s, dec, 5, ' '));
+  sb_term(&s);
+  assert(sb_cmp(&s, "Content-Length:   5\r\n\r\nhello") == 0);
+
+  /* A value that does not fit leaves the slot untouched */
+  assert(!sb_patch_decimal(&s, dec, 12345, ' '));
+  assert(sb_cmp(&s, "Content-Length:   5\r\n\r\nhello") == 0);
+
+  s.len = 0;
+  hex = sb_reserve_slot(&s, 3);
+  assert(sb_patch_hex(&s, hex, 0xa, ' '));
+  assert(buf[0] == ' ' && buf[1] == ' ' && buf[2] == 'a');
+
+  /* Slot past the capacity is never patched */
+  sb_init(&s, buf, 4);
+  sb_append_cstr(&s, "abc");
+  len4 = sb_reserve_slot(&s, 4);
+  assert(s.ovr == 1 && s.len == 7);
+  assert(!sb_patch_u32le(&s, len4, 1));
+}
+
+void sb_test_binary_encoding(void)
+{
+  char buf[64];
+  sb s;
+  sb_u64 u = 0;
+  sb_i64 i = 0;
+  int k;
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_append_u16le(&s, 0x1234u);
+  sb_append_u32be(&s, 0xdeadbeefu);
+  sb_append_u64le(&s, SB_U64(0x01020304ul, 0x05060708ul));
+  sb_append_f64be(&s, 1.5);
+  assert(s.len == 22);
+  assert(buf[0] == 0x34 && buf[1] == 0x12);
+  assert((unsigned char)buf[2] == 0xde && (unsigned char)buf[5] == 0xef);
+  assert(buf[6] == 0x08 && buf[13] == 0x01);
+  assert(buf[14] == 0x3f && (unsigned char)buf[15] == 0xf8 && buf[21] == 0);
+  assert(sb_load_u16le(buf) == 0x1234u);
+  assert(sb_load_u32be(buf + 2) == 0xdeadbeefu);
+  assert(sb_load_u64le(buf + 6) == SB_U64(0x01020304ul, 0x05060708ul));
+  assert(sb_load_f64be(buf + 14) == 1.5);
+
+  assert(sb_varint_len(0) == 1 && sb_varint_len(127) == 1 && sb_varint_len(128) == 2);
+  assert(sb_varint_len(SB_U64(0xfffffffful, 0xfffffffful)) == 10);
+
+  s.len = 0;
+  assert(sb_append_varint_u64(&s, 300) == 2);
+  assert((unsigned char)buf[0] == 0xac && buf[1] == 0x02);
+  assert(sb_append_zigzag_i64(&s, -1) == 1 && buf[2] == 0x01);
+  assert(sb_zigzag_encode64(1) == 2 && sb_zigzag_decode64(3) == -2);
+
+  /* Round trip across all lengths, including the 10 byte varint near the capacity */
+  for (k = 0; k < 64; k += 7)
+  {
+    sb_u64 v = SB_U64(0xfffffffful, 0xfffffffful) >> k;
+    sb_init(&s, buf, 12);
+    sb_putc(&s, 'x');
+    sb_putc(&s, 'x');
+    sb_append_varint_u64(&s, v);
+    assert(sb_varint_decode_u64(buf + 2, (int)s.len - 2, &u) == s.len - 2 && u == v);
+  }
+
+  s.len = 0;
+  sb_append_zigzag_i64(&s, -123456789);
+  assert(sb_varint_decode_i64(buf, (int)s.len, &i) == s.len && i == -123456789);
+  assert(sb_varint_decode_u64(buf, (int)s.len - 1, &u) == 0);
+
+  /* Overflow keeps counting like text appends */
+  sb_init(&s, buf, 3);
+  sb_append_u32le(&s, 1);
+  assert(s.ovr == 1 && s.len == 4);
+}
+
+void sb_test_msgpack(void)
+{
+  static unsigned char expected[] = {
+      0xdf, 0x00, 0x00, 0x00, 0x03,
+      0xa1, 'a', 0x01,
+      0xa1, 'b', 0x93, 0xff, 0xcd, 0x01, 0x2c, 0xca, 0x3f, 0xc0, 0x00, 0x00,
+      0xa1, 'c', 0xdd, 0x00, 0x00, 0x00, 0x04, 0xc0, 0xc3, 0xd1, 0xff, 0x38,
+      0xcb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a};
+  char buf[128];
+  char bin[3];
+  sb s;
+  sb_msgpack mp;
+  int i;
+
+  sb_init(&s, buf, sizeof(buf));
+  sb_msgpack_init(&mp, &s);
+
+  sb_msgpack_map_begin(&mp);
+  sb_msgpack_str(&mp, "a");
+  sb_msgpack_int(&mp, 1);
+  sb_msgpack_str(&mp, "b");
+  sb_msgpack_array(&mp, 3);
+  sb_msgpack_int(&mp, -1);
+  sb_msgpack_uint(&mp, 300);
+  sb_msgpack_double(&mp, 1.5);
+  sb_msgpack_str(&mp, "c");
+  sb_msgpack_array_begin(&mp);
+  sb_msgpack_nil(&mp);
+  sb_msgpack_bool(&mp, 1);
+  sb_msgpack_int(&mp, -200);
+  sb_msgpack_double(&mp, 0.1);
+  sb_msgpack_array_end(&mp);
+  sb_msgpack_map_end(&mp);
+
+  assert(mp.err == 0 && mp.depth == 0);
+  assert(s.len == (int)sizeof(expected));
+
+  for (i = 0; i < (int)sizeof(expected); ++i)
+  {
+    assert((unsigned char)buf[i] == expected[i]);
+  }
+
+  /* Smallest forms at the boundaries */
+  s.len = 0;
+  sb_msgpack_int(&mp, -32);
+  sb_msgpack_int(&mp, -33);
+  sb_msgpack_uint(&mp, 127);
+  sb_msgpack_uint(&mp, 128);
+  sb_msgpack_uint(&mp, 70000);
+  sb_msgpack_str(&mp, "0123456789012345678901234567890123456789");
+  assert((unsigned char)buf[0] == 0xe0);
+  assert((unsigned char)buf[1] == 0xd0 && (unsigned char)buf[2] == 0xdf);
+  assert(buf[3] == 0x7f);
+  assert((unsigned char)buf[4] == 0xcc && (unsigned char)buf[5] == 0x80);
+  assert((unsigned char)buf[6] == 0xce && buf[9] == 0x11 && buf[10] == 0x70);
+  assert((unsigned char)buf[11] == 0xd9 && buf[12] == 40);
+
+  s.len = 0;
+  bin[0] = 1;
+  bin[1] = 0;
+  bin[2] = 2;
+  sb_msgpack_bin(&mp, bin, 3);
+  sb_msgpack_map(&mp, 0);
+  assert(s.len == 6 && (unsigned char)buf[0] == 0xc4 && buf[1] == 3 && buf[4] == 2);
+  assert((unsigned char)buf[5] == 0x80 && mp.depth == 0);
+
+  /* Doubles beyond the float range stay float 64 */
+  s.len = 0;
+  sb_msgpack_double(&mp, 1e300);
+  sb_msgpack_double(&mp, -3.5e38);
+  sb_msgpack_double(&mp, -2.0);
+  assert(s.len == 9 + 9 + 5);
+  assert((unsigned char)buf[0] == 0xcb && (unsigned char)buf[9] == 0xcb && (unsigned char)buf[18] == 0xca);
+
+  /* Nesting misuse */
+  sb_msgpack_map_begin(&mp);
+  sb_msgpack_str(&mp, "k");
+  sb_msgpack_map_end(&mp);
+  assert(mp.err == 1);
+  sb_msgpack_init(&mp, &s);
+  sb_msgpack_array_end(&mp);
+  assert(mp.err == 1);
+
+  /* Overflow: the header slot is skipped, ovr reports the failure */
+  sb_init(&s, buf, 4);
+  sb_msgpack_init(&mp, &s);
+  sb_msgpack_array_begin(&mp);
+  sb_msgpack_int(&mp, 1);
+  sb_msgpack_array_end(&mp);
+  assert(s.ovr == 1 && s.len == 6 && mp.err == 0);
+}
+
+void sb_test_cpu_dispatch(void)
+{
+  unsigned int features = sb_cpu_features();
+  char src[100];
+  char enc[2][140];
+  char dec[2][110];
+  int enc_len[2];
+  int dec_len[2];
+  int valid[2];
+  unsigned int crc[2];
+  int pass;
+  int i;
+
+#if defined(__x86_64__) && !defined(SB_CPU_PIN)
+  assert(features & SB_CPU_SSE2);
+#endif
+  assert(sb_cpu_features() == features);
+
+  for (i = 0; i < (int)sizeof(src); ++i)
+  {
+    src[i] = (char)(i * 7 + 3);
+  }
+
+  /* The selected kernels and the scalar paths agree */
+  for (pass = 0; pass < 2; ++pass)
+  {
+    sb_cpu_dispatch(pass ? 0u : features);
+    assert(sb_cpu_kernels()->features == (pass ? 0u : features));
+
+    enc_len[pass] = sb_base64_encode(enc[pass], src, (int)sizeof(src), 0);
+    dec_len[pass] = sb_base64_decode(dec[pass], enc[pass], enc_len[pass]);
+    valid[pass] = sb_utf8_validate(src, (int)sizeof(src));
+    crc[pass] = sb_crc32c_bytes(0, src, (int)sizeof(src));
+  }
+
+  sb_cpu_dispatch(features);
+
+  assert(enc_len[0] == 136 && enc_len[1] == 136);
+  assert(dec_len[0] == (int)sizeof(src) && dec_len[1] == (int)sizeof(src));
+  assert(valid[0] == 0 && valid[1] == 0);
+  assert(crc[0] == crc[1]);
+
+  for (i = 0; i < enc_len[0]; ++i)
+  {
+    assert(enc[0][i] == enc[1][i]);
+  }
+
+  for (i = 0; i < (int)sizeof(src); ++i)
+  {
+    assert(dec[0][i] == src[i] && dec[1][i] == src[i]);
+  }
+}
+
+void sb_test_size_overflow(void)
+{
+  static char chunk[1024];
+  volatile sb_size near_max = SB_SIZE_MAX - 2;
+  char buf[16];
+  sb s;
+  int i;
+
+  /* Measuring 3 GB of output: the required size never wraps around */
+  sb_init(&s, buf, sizeof(buf));
+
+  for (i = 0; i < 3 * 1024 * 1024; ++i)
+  {
+    sb_append_bytes(&s, chunk, (int)sizeof(chunk));
+  }
+
+  assert(s.ovr == 1);
+#ifdef SB_WIDE
+  assert(s.len == (sb_size)3 * 1024 * 1024 * 1024);
+  assert(sizeof(sb_size) == 8);
+#else
+  assert(s.len == SB_SIZE_MAX);
+#endif
+
+  /* Saturates at SB_SIZE_MAX */
+  s.len = near_max;
+  sb_append_cstr(&s, "abcdef");
+  assert(s.len == SB_SIZE_MAX);
+  sb_putc(&s, 'x');
+  assert(s.len == SB_SIZE_MAX);
+
+  sb_term(&s);
+  assert(s.len == (sb_size)sizeof(buf) - 1);
+}
+
+#ifdef SB_LINUX_SYSCALLS
+void sb_test_map_line(sb *sb, void *ctx)
+{
+  sb_append_cstr(sb, "line ");
+  sb_append_long(sb, *(int *)ctx % 10000, 0, SB_PAD_NONE);
+  sb_putc(sb, '\n');
+}
+
+void sb_test_map(void)
+{
+  static char back[300000];
+  char *path = "/tmp/sb_test_map.tmp";
+  sb_map m;
+  long fd;
+  long n;
+  long total = 0;
+  int i;
+
+  assert(sb_map_open(&m, path, 16, SB_MAP_SEQUENTIAL | SB_MAP_HUGEPAGE) == 0);
+  assert(m.sb.cap == SB_MAP_GRANULE);
+
+  for (i = 0; i < 20000; ++i)
+  {
+    assert(sb_map_reserve(&m, 16) == 0);
+    sb_append_cstr(&m.sb, "line ");
+    sb_append_long(&m.sb, i % 10000, 0, SB_PAD_NONE);
+    sb_putc(&m.sb, '\n');
+  }
+
+  assert(m.sb.ovr == 0 && m.sb.cap >= m.sb.len && m.mapped > SB_MAP_GRANULE);
+  assert(sb_map_close(&m) == 0);
+
+  /* The file holds exactly the formatted bytes */
+  fd = sb_syscall3(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 0);
+  assert(fd >= 0);
+
+  while ((n = sb_syscall3(SB_SYS_READ, fd, (long)(back + total), (long)sizeof(back) - total)) > 0)
+  {
+    total += n;
+  }
+
+  sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+  sb_syscall3(SB_SYS_UNLINKAT, SB_AT_FDCWD, (long)path, 0);
+
+  assert(total == 20000 * 6 + (10 + 90 * 2 + 900 * 3 + 9000 * 4) * 2);
+  assert(back[0] == 'l' && back[5] == '0' && back[6] == '\n');
+  assert(back[total - 5] == '9' && back[total - 1] == '\n');
+
+  /* sb_map_format and sb_map_append_bytes grow on their own, the output is the same */
+  assert(sb_map_open(&m, path, 16, 0) == 0);
+
+  for (i = 0; i < 20000; ++i)
+  {
+    assert(sb_map_format(&m, sb_test_map_line, &i) == 0);
+  }
+
+  assert(m.sb.ovr == 0 && m.mapped > SB_MAP_GRANULE && m.sb.len == total);
+  assert(sb_map_append_bytes(&m, back, (sb_size)total) == 0);
+  assert(m.sb.ovr == 0 && m.sb.len == total * 2);
+  assert(m.sb.buf[0] == 'l' && m.sb.buf[total] == 'l' && m.sb.buf[total * 2 - 1] == '\n');
+  assert(sb_map_close(&m) == 0);
+
+  fd = sb_syscall3(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 0);
+  assert(sb_syscall3(SB_SYS_LSEEK, fd, 0, 2) == total * 2); /* SEEK_END */
+  sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+  sb_syscall3(SB_SYS_UNLINKAT, SB_AT_FDCWD, (long)path, 0);
+
+  /* Appending past the mapping without reserving fails loudly, the stored bytes are kept */
+  assert(sb_map_open(&m, path, 16, 0) == 0);
+
+  for (i = 0; i < SB_MAP_GRANULE / 4 + 1; ++i)
+  {
+    sb_append_cstr(&m.sb, "abcd");
+  }
+
+  assert(m.sb.ovr == 1);
+  assert(sb_map_reserve(&m, 4) == -1 && m.err == 28); /* ENOSPC */
+  assert(sb_map_term(&m) == -1 && m.sb.buf == 0 && m.mapped == 0);
+  assert(sb_map_term(&m) == -1);
+  assert(sb_syscall3(SB_SYS_LSEEK, m.fd, 0, 2) == SB_MAP_GRANULE); /* SEEK_END */
+  assert(sb_map_close(&m) == -1);
+  sb_syscall3(SB_SYS_UNLINKAT, SB_AT_FDCWD, (long)path, 0);
+
+  assert(sb_map_format(&m, sb_test_map_line, &i) == -1);
+  assert(sb_map_append_bytes(&m, "x", 1) == -1);
+
+  assert(sb_map_open(&m, "/nonexistent/dir/file", 16, 0) == -1);
+  assert(m.err == 2); /* ENOENT */
+  assert(sb_map_reserve(&m, 4) == -1);
+}
+
+void sb_test_writer(void)
+{
+  static char back[20000];
+  static char mem[3 * 64];
+  char *path = "/tmp/sb_test_writer.tmp";
+  sb_writer w;
+  long fd;
+  long n;
+  long total = 0;
+  int i;
+
+  fd = sb_syscall6(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 01 | 0100 | 01000, 0644, 0, 0);
+  assert(fd >= 0);
+
+  /* Three tiny buffers so the producer runs into backpressure constantly */
+  assert(sb_writer_start(&w, fd, mem, sizeof(mem), 3, 0) == 0);
+  assert(w.count == 3 && w.size == 64 && w.sb.cap == 64);
+
+  for (i = 0; i < 2000; ++i)
+  {
+    assert(sb_writer_reserve(&w, 8) == 0);
+    sb_append_cstr(&w.sb, "row ");
+    sb_append_long(&w.sb, i % 1000, 0, SB_PAD_NONE);
+    sb_putc(&w.sb, '\n');
+
+    if (i == 1000)
+    {
+      assert(sb_writer_flush(&w) == 0);
+      assert(w.drained == w.filled && w.sb.len == 0);
+    }
+  }
+
+  assert(sb_writer_reserve(&w, 65) == -1);
+  assert(sb_writer_sync(&w) == 0);
+  assert(sb_writer_stop(&w) == 0);
+  assert(w.thread.handle == 0);
+  sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+
+  /* Every row arrives in order */
+  fd = sb_syscall3(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 0);
+  assert(fd >= 0);
+
+  while ((n = sb_syscall3(SB_SYS_READ, fd, (long)(back + total), (long)sizeof(back) - total)) > 0)
+  {
+    total += n;
+  }
+
+  sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+  sb_syscall3(SB_SYS_UNLINKAT, SB_AT_FDCWD, (long)path, 0);
+
+  assert(total == 2000 * 5 + (10 + 90 * 2 + 900 * 3) * 2);
+  assert(back[0] == 'r' && back[4] == '0' && back[5] == '\n');
+  assert(back[total - 4] == '9' && back[total - 1] == '\n');
+
+  /* Appending past a buffer without reserving is reported on the barrier, output keeps flowing */
+  fd = sb_syscall6(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 01 | 0100 | 01000, 0644, 0, 0);
+  assert(sb_writer_start(&w, fd, mem, sizeof(mem), 3, 0) == 0);
+
+  for (i = 0; i < 20; ++i)
+  {
+    sb_append_cstr(&w.sb, "0123456789");
+  }
+
+  assert(w.sb.ovr == 1);
+  assert(sb_writer_flush(&w) == -1 && w.err == 28); /* ENOSPC */
+  sb_append_cstr(&w.sb, "tail");
+  assert(sb_writer_stop(&w) == -1);
+  assert(sb_syscall3(SB_SYS_LSEEK, fd, 0, 2) == 64 + 4); /* SEEK_END */
+  sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+  sb_syscall3(SB_SYS_UNLINKAT, SB_AT_FDCWD, (long)path, 0);
+
+  /* Write errors surface on the barrier */
+  assert(sb_writer_start(&w, -1, mem, sizeof(mem), 2, 0) == 0);
+  sb_append_cstr(&w.sb, "lost");
+  assert(sb_writer_flush(&w) == -1);
+  assert(w.err == 9); /* EBADF */
+  assert(sb_writer_stop(&w) == -1);
+}
+
+void sb_test_sink(void)
+{
+  static char back[40000];
+  static char mem[4 * 128];
+  char *path = "/tmp/sb_test_sink.tmp";
+  sb_sink s;
+  long fd;
+  long n;
+  long total;
+  int mode;
+  int i;
+
+  for (mode = 0; mode < 2; ++mode)
+  {
+    fd = sb_syscall6(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 01 | 0100 | 01000, 0644, 0, 0);
+    assert(fd >= 0);
+    assert(sb_syscall3(SB_SYS_WRITE, fd, (long)"head\n", 5) == 5);
+
+    assert(sb_sink_open(&s, fd, mem, sizeof(mem), 4, mode ? SB_SINK_WRITEV : 0) == 0);
+    assert(s.count == 4 && s.size == 128 && s.sb.cap == 128);
+    assert(mode == 0 || s.uring == 0);
+
+    for (i = 0; i < 3000; ++i)
+    {
+      assert(sb_sink_reserve(&s, 8) == 0);
+      sb_append_cstr(&s.sb, "row ");
+      sb_append_long(&s.sb, i % 1000, 0, SB_PAD_NONE);
+      sb_putc(&s.sb, '\n');
+    }
+
+    assert(sb_sink_reserve(&s, 129) == -1);
+    assert(sb_sink_close(&s) == 0);
+
+    /* Buffers are pushed out in batches, far fewer syscalls than buffers */
+    assert(s.filled > 100 && s.syscalls * 3 < (long)s.filled);
+
+    /* The fd position follows the sink output */
+    assert(sb_syscall3(SB_SYS_WRITE, fd, (long)"tail\n", 5) == 5);
+    sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+
+    fd = sb_syscall3(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 0);
+    assert(fd >= 0);
+    total = 0;
+
+    while ((n = sb_syscall3(SB_SYS_READ, fd, (long)(back + total), (long)sizeof(back) - total)) > 0)
+    {
+      total += n;
+    }
+
+    sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+    sb_syscall3(SB_SYS_UNLINKAT, SB_AT_FDCWD, (long)path, 0);
+
+    assert(total == 10 + 3000 * 5 + (10 + 90 * 2 + 900 * 3) * 3);
+    assert(back[0] == 'h' && back[5] == 'r' && back[9] == '0' && back[10] == '\n');
+    assert(back[total - 9] == '9' && back[total - 5] == 't' && back[total - 1] == '\n');
+  }
+
+  /* Overflow without reserving is reported, the stored bytes and later output are still written */
+  for (mode = 0; mode < 2; ++mode)
+  {
+    fd = sb_syscall6(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 01 | 0100 | 01000, 0644, 0, 0);
+    assert(sb_sink_open(&s, fd, mem, sizeof(mem), 4, mode ? SB_SINK_WRITEV : 0) == 0);
+
+    for (i = 0; i < 20; ++i)
+    {
+      sb_append_cstr(&s.sb, "0123456789");
+    }
+
+    assert(s.sb.ovr == 1);
+    assert(sb_sink_reserve(&s, 129) == -1);
+    assert(sb_sink_flush(&s) == -1 && s.err == 28); /* ENOSPC */
+    sb_append_cstr(&s.sb, "tail");
+    assert(sb_sink_close(&s) == -1);
+    assert(sb_syscall3(SB_SYS_LSEEK, fd, 0, 2) == 128 + 4); /* SEEK_END */
+    sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+    sb_syscall3(SB_SYS_UNLINKAT, SB_AT_FDCWD, (long)path, 0);
+  }
+
+  /* O_APPEND fds ignore io_uring offsets, they use writev and still append in order */
+  fd = sb_syscall6(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 01 | 0100 | 01000 | 02000, 0644, 0, 0);
+  assert(sb_syscall3(SB_SYS_WRITE, fd, (long)"head\n", 5) == 5);
+  assert(sb_sink_open(&s, fd, mem, sizeof(mem), 4, 0) == 0);
+  assert(s.uring == 0);
+
+  for (i = 0; i < 1000; ++i)
+  {
+    assert(sb_sink_reserve(&s, 8) == 0);
+    sb_append_cstr(&s.sb, "row ");
+    sb_append_long(&s.sb, i % 10, 0, SB_PAD_NONE);
+    sb_putc(&s.sb, '\n');
+  }
+
+  assert(sb_sink_close(&s) == 0);
+  sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+
+  fd = sb_syscall3(SB_SYS_OPENAT, SB_AT_FDCWD, (long)path, 0);
+  total = 0;
+
+  while ((n = sb_syscall3(SB_SYS_READ, fd, (long)(back + total), (long)sizeof(back) - total)) > 0)
+  {
+    total += n;
+  }
+
+  sb_syscall3(SB_SYS_CLOSE, fd, 0, 0);
+  sb_syscall3(SB_SYS_UNLINKAT, SB_AT_FDCWD, (long)path, 0);
+
+  assert(total == 5 + 1000 * 6);
+
+  for (i = 0; i < 1000; ++i)
+  {
+    assert(back[5 + i * 6 + 4] == (char)('0' + i % 10) && back[5 + i * 6 + 5] == '\n');
+  }
+
+  assert(sb_sink_open(&s, 1, 0, 512, 4, 0) == -1);
+  assert(sb_sink_open(&s, 1, mem, 3, 4, 0) == -1 && s.sb.cap == 0);
+
+  /* Write errors surface on the barrier, in both modes */
+  assert(sb_sink_open(&s, -1, mem, sizeof(mem), 2, 0) == 0);
+  assert(s.uring == 0); /* lseek fails, no io_uring */
+  sb_append_cstr(&s.sb, "lost");
+  assert(sb_sink_close(&s) == -1);
+  assert(s.err == 9); /* EBADF */
+}
+
+void sb_test_parallel_row(sb *sb, int row, void *ctx)
+{
+  sb_json j;
+
+  sb_json_init(&j, sb);
+  sb_json_object_begin(&j);
+  sb_json_key(&j, "id");
+  sb_json_long(&j, row);
+  sb_json_key(&j, "v");
+  sb_json_double(&j, (double)row * 0.25, 2);
+  sb_json_key(&j, "s");
+  sb_json_string(&j, (row % 3) ? (char *)ctx : "tab\tquote\"");
+  sb_json_object_end(&j);
+  sb_putc(sb, ' ');
+  sb_append_hex(sb, (sb_u64)row * 2654435761u, 0, SB_PAD_NONE, SB_CASE_LOWER);
+  sb_putc(sb, '\n');
+}
+
+typedef struct sb_test_shim_counts
+{
+  int spawned;
+  int joined;
+
+} sb_test_shim_counts;
+
+/* Shim over the raw threads that counts its calls, the row formatter never touches libc */
+void *sb_test_shim_spawn(void *ctx, void (*fn)(void *), void *arg)
+{
+  ((sb_test_shim_counts *)ctx)->spawned++;
+  return sb_thread_raw_spawn(0, fn, arg);
+}
+
+void sb_test_shim_join(void *ctx, void *handle)
+{
+  ((sb_test_shim_counts *)ctx)->joined++;
+  sb_thread_raw_join(0, handle);
+}
+
+void sb_test_parallel(void)
+{
+  static char serial_buf[2000000];
+  static char parallel_buf[2000000];
+  sb serial;
+  sb parallel;
+  sb small;
+  char small_buf[64];
+  int i;
+  int same = 1;
+
+  /* Reference output formatted row by row */
+  sb_init(&serial, serial_buf, sizeof(serial_buf));
+  sb_append_cstr(&serial, "rows:\n");
+
+  for (i = 0; i < 20000; ++i)
+  {
+    sb_test_parallel_row(&serial, i, "plain");
+  }
+
+  assert(serial.ovr == 0);
+
+  /* Any thread count places every chunk exactly behind the existing content, one worker set per call */
+  for (i = 1; i <= 8; i *= 2)
+  {
+    sb_test_shim_counts counts = {0, 0};
+    sb_thread_shim shim;
+    sb_size k;
+
+    shim.ctx = &counts;
+    shim.spawn = sb_test_shim_spawn;
+    shim.join = sb_test_shim_join;
+
+    sb_init(&parallel, parallel_buf, sizeof(parallel_buf));
+    sb_append_cstr(&parallel, "rows:\n");
+    assert(sb_append_parallel(&parallel, 20000, sb_test_parallel_row, "plain", i, &shim) == 0);
+    assert(parallel.len == serial.len && parallel.ovr == 0);
+    assert(counts.spawned == i - 1 && counts.joined == i - 1);
+
+    for (k = 0; k < serial.len; ++k)
+    {
+      same &= (parallel_buf[k] == serial_buf[k]);
+    }
+  }
+
+  assert(same);
+
+  /* Without a shim everything runs on the caller */
+  sb_init(&parallel, parallel_buf, sizeof(parallel_buf));
+  sb_append_cstr(&parallel, "rows:\n");
+  assert(sb_append_parallel(&parallel, 20000, sb_test_parallel_row, "plain", 8, 0) == 0);
+  assert(parallel.len == serial.len && parallel_buf[serial.len - 1] == '\n');
+
+  /* More threads than rows */
+  sb_init(&parallel, parallel_buf, sizeof(parallel_buf));
+  assert(sb_append_parallel(&parallel, 3, sb_test_parallel_row, "plain", 16, &SB_THREAD_SHIM_RAW) == 0);
+  sb_term(&parallel);
+  assert(parallel_buf[0] == '{' && parallel_buf[parallel.len - 1] == '\n');
+  assert(sb_append_parallel(&parallel, 0, sb_test_parallel_row, "plain", 4, 0) == 0);
+
+  /* Does not fit: nothing is written, len holds the required size */
+  for (i = 0; i < (int)sizeof(small_buf); ++i)
+  {
+    small_buf[i] = '#';
+  }
+
+  sb_init(&small, small_buf, sizeof(small_buf));
+  sb_append_cstr(&small, "x");
+  assert(sb_append_parallel(&small, 20000, sb_test_parallel_row, "plain", 4, &SB_THREAD_SHIM_RAW) == -1);
+  assert(small.ovr == 1 && small.len == serial.len - 5);
+  assert(small_buf[0] == 'x' && small_buf[1] == '#' && small_buf[63] == '#');
+}
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+typedef struct sb_test_ring_producer
+{
+  sb_ring *ring;
+  int id;
+  int count;
+
+} sb_test_ring_producer;
+
+void sb_test_ring_produce(void *arg)
+{
+  sb_test_ring_producer *p = (sb_test_ring_producer *)arg;
+  sb s;
+  int i;
+
+  for (i = 0; i < p->count; ++i)
+  {
+    sb_ring_begin(p->ring, &s, 16);
+    sb_putc(&s, (char)('a' + p->id));
+    sb_append_long(&s, i, 0, SB_PAD_NONE);
+    sb_putc(&s, '\n');
+    sb_ring_end(p->ring, &s);
+  }
+}
+
+void sb_test_ring(void)
+{
+  static char mem[1024];
+  static char out_buf[256];
+  sb_ring r;
+  sb s;
+  sb out;
+
+  assert(sb_ring_init(&r, mem, 8) == -1);
+  assert(sb_ring_init(&r, mem, 1000) == 0);
+  assert(r.cap == 512);
+  assert(sb_ring_begin(&r, &s, 505) == -1);
+
+  /* Records come out in reservation order, uncommitted ones block the ones behind them */
+  sb_init(&out, out_buf, sizeof(out_buf));
+  {
+    sb a;
+    sb b;
+
+    assert(sb_ring_begin(&r, &a, 16) == 0);
+    assert(sb_ring_begin(&r, &b, 16) == 0);
+    sb_append_cstr(&b, "second;");
+    sb_ring_end(&r, &b);
+    assert(sb_ring_drain(&r, &out) == 0);
+
+    sb_append_cstr(&a, "first;");
+    sb_ring_end(&r, &a);
+    assert(sb_ring_drain(&r, &out) == 13);
+    assert(sb_cmp(&out, "first;second;") == 0);
+  }
+
+  /* A builder overflow commits the stored bytes */
+  sb_init(&out, out_buf, sizeof(out_buf));
+  assert(sb_ring_begin(&r, &s, 4) == 0);
+  sb_append_cstr(&s, "truncated");
+  sb_ring_end(&r, &s);
+  assert(sb_ring_drain(&r, &out) == 8 && sb_cmp(&out, "truncate") == 0);
+
+  /* Wrapping around the end many times */
+  {
+    int i;
+    int ok = 1;
+
+    for (i = 0; i < 1000; ++i)
+    {
+      sb_init(&out, out_buf, sizeof(out_buf));
+      assert(sb_ring_begin(&r, &s, 40) == 0);
+      sb_append_long(&s, i, 0, SB_PAD_NONE);
+      sb_ring_end(&r, &s);
+      sb_ring_drain(&r, &out);
+      ok &= (sb_stored_len(&out) > 0 && out_buf[sb_stored_len(&out) - 1] == (char)('0' + i % 10));
+    }
+
+    assert(ok);
+  }
+
+#ifdef SB_LINUX_SYSCALLS
+  /* Three producer threads, the consumer sees every thread's lines complete and in order */
+  {
+    static char drained[200000];
+    sb_test_ring_producer producers[3];
+    sb_thread threads[3];
+    sb_size total = 0;
+    int next[3] = {0, 0, 0};
+    int ok = 1;
+    int i;
+
+    for (i = 0; i < 3; ++i)
+    {
+      producers[i].ring = &r;
+      producers[i].id = i;
+      producers[i].count = 10000;
+      assert(sb_thread_start(&threads[i], 0, sb_test_ring_produce, &producers[i]) == 0);
+    }
+
+    sb_init(&out, drained, sizeof(drained));
+
+    while (out.len < 3 * (10 + 90 * 2 + 900 * 3 + 9000 * 4 + 10000 * 2))
+    {
+      if (sb_ring_drain(&r, &out) == 0)
+      {
+        sb_ring_pause();
+      }
+    }
+
+    for (i = 0; i < 3; ++i)
+    {
+      sb_thread_join(&threads[i]);
+    }
+
+    assert(sb_ring_drain(&r, &out) == 0 && out.ovr == 0);
+
+    while (total < out.len)
+    {
+      int id = drained[total++] - 'a';
+      int v = 0;
+
+      while (drained[total] != '\n')
+      {
+        v = v * 10 + (drained[total++] - '0');
+      }
+
+      total++;
+      ok &= (id >= 0 && id < 3 && v == next[id]);
+      next[id & 3]++;
+    }
+
+    assert(ok);
+    assert(next[0] == 10000 && next[1] == 10000 && next[2] == 10000);
+  }
+#endif
+}
+
+typedef struct sb_test_pool_worker
+{
+  sb_pool *pool;
+  int id;
+  int bad;
+
+} sb_test_pool_worker;
+
+void sb_test_pool_work(void *arg)
+{
+  sb_test_pool_worker *w = (sb_test_pool_worker *)arg;
+  sb_pool_cache c;
+  sb held[4];
+  int i;
+  int k;
+
+  sb_pool_cache_init(&c, w->pool);
+
+  for (i = 0; i < 20000; ++i)
+  {
+    /* Hold a few buffers at once so caches spill and refill through the shared freelist */
+    for (k = 0; k < 4; ++k)
+    {
+      if (sb_pool_acquire(&c, &held[k]) != 0)
+      {
+        w->bad++;
+        return;
+      }
+
+      sb_putc(&held[k], (char)('a' + w->id));
+      sb_append_long(&held[k], i, 0, SB_PAD_NONE);
+    }
+
+    for (k = 0; k < 4; ++k)
+    {
+      w->bad += (held[k].buf[0] != (char)('a' + w->id) || held[k].len < 2);
+      sb_pool_release(&c, &held[k]);
+    }
+
+    /* Uneven spill pattern */
+    if (i % 7 == 0)
+    {
+      sb_pool_cache_flush(&c);
+    }
+  }
+
+  sb_pool_cache_flush(&c);
+}
+
+void sb_test_pool(void)
+{
+  static char mem[128 * 64];
+  sb_pool p;
+  sb_pool_cache c;
+  sb bufs[128];
+  sb s;
+  int i;
+  int distinct = 1;
+
+  assert(sb_pool_init(&p, mem, sizeof(mem), 67) == 128);
+  assert(p.size == 64);
+  sb_pool_cache_init(&c, &p);
+
+  /* Every buffer can be taken exactly once */
+  for (i = 0; i < 128; ++i)
+  {
+    assert(sb_pool_acquire(&c, &bufs[i]) == 0);
+    assert(bufs[i].cap == 64 && bufs[i].len == 0);
+    bufs[i].buf[0] = 1;
+  }
+
+  for (i = 0; i < 128; ++i)
+  {
+    distinct &= (bufs[i].buf[0] == 1);
+    bufs[i].buf[0] = 0;
+  }
+
+  assert(distinct);
+  assert(sb_pool_acquire(&c, &s) == -1);
+
+  for (i = 0; i < 128; ++i)
+  {
+    sb_pool_release(&c, &bufs[i]);
+    assert(c.n <= SB_POOL_CACHE);
+  }
+
+  assert(bufs[0].buf == 0 && bufs[0].cap == 0);
+
+  /* The common case stays in the cache */
+  assert(sb_pool_acquire(&c, &s) == 0);
+  sb_append_cstr(&s, "reuse");
+  i = c.n;
+  sb_pool_release(&c, &s);
+  assert(c.n == i + 1);
+  sb_pool_cache_flush(&c);
+  assert(c.n == 0);
+
+#ifdef SB_LINUX_SYSCALLS
+  /* Four threads hammer the freelist, no buffer is ever handed out twice and none is lost */
+  {
+    sb_test_pool_worker workers[4];
+    sb_thread threads[4];
+    int free_count = 0;
+
+    for (i = 0; i < 4; ++i)
+    {
+      workers[i].pool = &p;
+      workers[i].id = i;
+      workers[i].bad = 0;
+      assert(sb_thread_start(&threads[i], 0, sb_test_pool_work, &workers[i]) == 0);
+    }
+
+    for (i = 0; i < 4; ++i)
+    {
+      sb_thread_join(&threads[i]);
+      assert(workers[i].bad == 0);
+    }
+
+    while (sb_pool_pop(&p) >= 0)
+    {
+      free_count++;
+    }
+
+    assert(free_count == 128);
+  }
+#endif
+}
+
+typedef struct sb_test_snapshot_writer
+{
+  sb_snapshot *snap;
+  int generations;
+  int done;
+
+} sb_test_snapshot_writer;
+
+/* Snapshot n is "<n>:" followed by n % 200 copies of one letter and "#<n>" */
+void sb_test_snapshot_format(sb *sb, int n)
+{
+  int i;
+
+  sb_append_long(sb, n, 0, SB_PAD_NONE);
+  sb_putc(sb, ':');
+
+  for (i = 0; i < n % 200; ++i)
+  {
+    sb_putc(sb, (char)('a' + n % 26));
+  }
+
+  sb_putc(sb, '#');
+  sb_append_long(sb, n, 0, SB_PAD_NONE);
+}
+
+int sb_test_snapshot_check(char *p, sb_size len)
+{
+  sb_size i = 0;
+  int n = 0;
+  int m = 0;
+  int k;
+
+  while (i < len && p[i] != ':')
+  {
+    n = n * 10 + (p[i++] - '0');
+  }
+
+  for (k = 0, ++i; k < n % 200; ++k, ++i)
+  {
+    if (i >= len || p[i] != (char)('a' + n % 26))
+    {
+      return 0;
+    }
+  }
+
+  if (i >= len || p[i++] != '#')
+  {
+    return 0;
+  }
+
+  while (i < len)
+  {
+    m = m * 10 + (p[i++] - '0');
+  }
+
+  return n == m;
+}
+
+void sb_test_snapshot_write(void *arg)
+{
+  sb_test_snapshot_writer *w = (sb_test_snapshot_writer *)arg;
+  sb s;
+  int n;
+
+  for (n = 1; n <= w->generations; ++n)
+  {
+    sb_snapshot_begin(w->snap, &s);
+    sb_test_snapshot_format(&s, n);
+    sb_snapshot_publish(w->snap, &s);
+  }
+
+  __atomic_store_n(&w->done, 1, __ATOMIC_RELEASE);
+}
+
+void sb_test_snapshot(void)
+{
+  static char mem[2 * 512];
+  char copy[512];
+  sb_snapshot snap;
+  sb_view v;
+  sb s;
+  sb_size len;
+  unsigned long seq;
+
+  sb_snapshot_init(&snap, mem, sizeof(mem));
+  assert(snap.cap == 512);
+  assert(sb_snapshot_copy(&snap, copy, sizeof(copy)) == 0);
+
+  sb_snapshot_begin(&snap, &s);
+  sb_append_cstr(&s, "status: ok");
+  assert(sb_snapshot_copy(&snap, copy, sizeof(copy)) == 0); /* Not published yet */
+  sb_snapshot_publish(&snap, &s);
+
+  len = sb_snapshot_copy(&snap, copy, sizeof(copy));
+  assert(len == 10 && copy[0] == 's' && copy[9] == 'k');
+  assert(sb_snapshot_copy(&snap, copy, 4) == 10);
+
+  /* A view stays valid until the next swap */
+  seq = sb_snapshot_read_begin(&snap, &v);
+  assert(v.len == 10 && v.ptr == mem + 512);
+  assert(sb_snapshot_read_retry(&snap, seq) == 0);
+
+  sb_snapshot_begin(&snap, &s);
+  sb_append_cstr(&s, "status: degraded");
+  sb_snapshot_publish(&snap, &s);
+  assert(sb_snapshot_read_retry(&snap, seq) == 1);
+
+  seq = sb_snapshot_read_begin(&snap, &v);
+  assert(v.len == 16 && v.ptr == mem && (seq & 1) == 0);
+
+#ifdef SB_LINUX_SYSCALLS
+  /* A writer thread republishes constantly, every copy is one complete generation */
+  {
+    sb_test_snapshot_writer w;
+    sb_thread thread;
+    int ok = 1;
+    int reads = 0;
+
+    w.snap = &snap;
+    w.generations = 200000;
+    w.done = 0;
+
+    sb_snapshot_begin(&snap, &s);
+    sb_test_snapshot_format(&s, 0);
+    sb_snapshot_publish(&snap, &s);
+    assert(sb_thread_start(&thread, 0, sb_test_snapshot_write, &w) == 0);
+
+    while (!__atomic_load_n(&w.done, __ATOMIC_ACQUIRE) || reads == 0)
+    {
+      len = sb_snapshot_copy(&snap, copy, sizeof(copy));
+      ok &= (len <= (sb_size)sizeof(copy) && sb_test_snapshot_check(copy, len));
+      reads++;
+    }
+
+    sb_thread_join(&thread);
+    assert(ok);
+
+    len = sb_snapshot_copy(&snap, copy, sizeof(copy));
+    assert(sb_test_snapshot_check(copy, len) && copy[0] == '2' && copy[len - 1] == '0');
+  }
+#endif
+}
+#endif
+
 int main(void)
 {
   sb_test_init_term();
@@ -184,6 +1846,35 @@ int main(void)
   sb_test_append_double_float();
   sb_test_padding_and_format();
   sb_test_printf();
+  sb_test_append_hex_oct_bin();
+  sb_test_append_hex_bytes_hexdump();
+  sb_test_base64();
+  sb_test_json();
+  sb_test_csv();
+  sb_test_html_xml_url_escaping();
+  sb_test_utf8();
+  sb_test_utf16();
+  sb_test_truncation();
+  sb_test_arena();
+  sb_test_intern();
+  sb_test_hash();
+  sb_test_crc32c();
+  sb_test_backpatch();
+  sb_test_binary_encoding();
+  sb_test_msgpack();
+  sb_test_cpu_dispatch();
+  sb_test_size_overflow();
+#ifdef SB_LINUX_SYSCALLS
+  sb_test_map();
+  sb_test_writer();
+  sb_test_sink();
+  sb_test_parallel();
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+  sb_test_ring();
+  sb_test_pool();
+  sb_test_snapshot();
+#endif
 
   test_print_string("[sb] passed all tests");
 